@@ -0,0 +1,367 @@
+// Throughput benchmark for one of the parser implementations.
+// Implementation is included as a single translation unit, see bench.sh:
+// g++ -O2 -DNDEBUG -std=c++23 -DJSON_SOURCE='"../json_23.cpp"' bench/bench.cpp
+#ifndef JSON_SOURCE
+#error "JSON_SOURCE must name the implementation file"
+#endif
+
+#define JSON_NO_MAIN
+#include JSON_SOURCE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+
+// Every heap allocation of the process is counted, arenas and coroutine frames included
+static std::atomic<std::size_t> allocations { 0 };
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc {};
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    const auto align = static_cast<std::size_t>(alignment);
+    if (void* p = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return p;
+    }
+    throw std::bad_alloc {};
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+
+// Replaced operator new allocates with malloc, but GCC pairs inlined free() with the declared operator new
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+
+namespace {
+
+// Counts formatted bytes, so the output can't be optimized away
+class null_sink : public json::sink {
+public:
+    ~null_sink() override { flush(); }
+
+    std::size_t written = 0;
+
+protected:
+    void write(std::string_view data) override { written += data.size(); }
+};
+
+struct corpus {
+    std::string name;
+    std::string text;
+};
+
+// Synthetic corpora use raw std::mt19937_64 output, which is the same for every standard library
+corpus make_deep(std::size_t size)
+{
+    std::string text = "[";
+    while (text.size() < size) {
+        text += text.size() > 1 ? ", " : "";
+        for (int i = 0; i < 500; ++i) {
+            text += i % 2 ? "{\"k\": " : "[";
+        }
+        text += "1";
+        for (int i = 499; i >= 0; --i) {
+            text += i % 2 ? "}" : "]";
+        }
+    }
+    return { "deep", text + "]" };
+}
+
+corpus make_wide(std::size_t size)
+{
+    std::string text = "{";
+    for (std::size_t i = 0; text.size() < size; ++i) {
+        text += (i ? ", \"key_" : "\"key_") + std::to_string(i) + "\": " + std::to_string(i * 7);
+    }
+    return { "wide", text + "}" };
+}
+
+corpus make_numbers(std::size_t size)
+{
+    std::mt19937_64 random { 42 };
+    std::string text = "[";
+    char buffer[32];
+    for (std::size_t i = 0; text.size() < size; ++i) {
+        const auto bits = random();
+        const auto result = i % 2
+            ? std::to_chars(buffer, buffer + sizeof(buffer), static_cast<int64_t>(bits >> 20) - (int64_t { 1 } << 43))
+            : std::to_chars(buffer, buffer + sizeof(buffer), static_cast<double>(bits >> 11) * 0x1p-53 * 1e6 - 5e5);
+        text += i ? ", " : "";
+        text.append(buffer, result.ptr);
+    }
+    return { "numbers", text + "]" };
+}
+
+corpus make_strings(std::size_t size)
+{
+    std::mt19937_64 random { 42 };
+    std::string text = "[";
+    for (std::size_t i = 0; text.size() < size; ++i) {
+        text += i ? ", \"" : "\"";
+        for (auto length = random() % 200; length != 0; --length) {
+            text += static_cast<char>('a' + random() % 26);
+        }
+        text += '"';
+    }
+    return { "strings", text + "]" };
+}
+
+corpus read_corpus(const std::string& path)
+{
+    std::ifstream file { path, std::ios::binary };
+    if (!file) {
+        throw json::parse_error { "Cannot open " + path };
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    const auto slash = path.find_last_of('/');
+    return { slash == std::string::npos ? path : path.substr(slash + 1), text.str() };
+}
+
+// Parser doesn't support true, false and null, error is detected at the literal or right after its first byte
+bool is_literal_at(std::string_view text, std::size_t offset)
+{
+    for (const std::string_view literal : { "true", "false", "null" }) {
+        for (const auto at : { offset, offset - 1 }) {
+            if (at < text.size() && text.substr(at, literal.size()) == literal) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Tokens as the lexer sees them, punctuation included
+std::size_t count_tokens(std::string_view text)
+{
+    using token_type = json::lexer::token_type;
+    json::lexer lexer { std::make_unique<json::memory_source>(text) };
+    std::size_t tokens = 0;
+    for (auto type = lexer.peek_type(); type != token_type::END_OF_INPUT; type = lexer.peek_type(), ++tokens) {
+        if (type == token_type::STRING) {
+            (void)lexer.next_string();
+        } else if (type == token_type::NUMBER) {
+            (void)lexer.next_number();
+        } else {
+            (void)lexer.try_consume_token(type);
+        }
+    }
+    return tokens;
+}
+
+// Reads every value the way a consumer iterating streams would
+void drain(json::json& value)
+{
+    if (auto* object = std::get_if<json::object_stream>(&value)) {
+        for (auto& pair : *object) {
+            drain(pair.second);
+        }
+    } else if (auto* array = std::get_if<json::array_stream>(&value)) {
+        for (auto& element : *array) {
+            drain(element);
+        }
+    }
+}
+
+// Same as drain() with object keys interned in the parser's key_pool
+void drain_interned(json::json& value)
+{
+    if (auto* object = std::get_if<json::object_stream>(&value)) {
+        while (object->next_interned_key()) {
+            auto element = object->read_value();
+            drain_interned(element);
+        }
+    } else if (auto* array = std::get_if<json::array_stream>(&value)) {
+        for (auto& element : *array) {
+            drain_interned(element);
+        }
+    }
+}
+
+// Counts parsing events, so the SAX benchmark measures parsing alone
+struct counting_handler {
+    std::size_t events = 0;
+
+    void on_begin_object() { ++events; }
+    void on_end_object() { ++events; }
+    void on_begin_array() { ++events; }
+    void on_end_array() { ++events; }
+    void on_key(std::string_view) { ++events; }
+    void on_string(std::string_view) { ++events; }
+    void on_int(int64_t) { ++events; }
+    void on_double(double) { ++events; }
+};
+
+// Implementations differ in serialize() interface: C++17 writes into sink, C++23 yields chunks
+template <typename Value>
+auto serialize_to(json::sink& out, indent_cache& indent, Value& value, int) -> decltype(serialize(out, indent, value), void())
+{
+    serialize(out, indent, value);
+}
+
+template <typename Value>
+void serialize_to(json::sink& out, indent_cache& indent, Value& value, long)
+{
+    for (auto chunk : serialize(indent, value)) {
+        out.append(chunk);
+    }
+}
+
+struct benchmark {
+    const char* name;
+    void (*run)(std::string_view text, null_sink& out);
+};
+
+const benchmark benchmarks[] = {
+    { "lex", [](std::string_view text, null_sink&) { (void)count_tokens(text); } },
+    { "parse", [](std::string_view text, null_sink&) {
+         auto value = json::parse(text);
+         drain(value);
+     } },
+    { "parse-interned", [](std::string_view text, null_sink&) {
+         auto value = json::parse(text);
+         drain_interned(value);
+     } },
+    { "sax", [](std::string_view text, null_sink& out) {
+         json::lexer lexer { std::make_unique<json::memory_source>(text) };
+         counting_handler handler;
+         json::parse_events(lexer, handler);
+         out.written += handler.events;
+     } },
+    { "validate", [](std::string_view text, null_sink& out) {
+         out.written += static_cast<bool>(json::validate(std::make_unique<json::memory_source>(text)));
+     } },
+    { "serialize", [](std::string_view text, null_sink& out) {
+         indent_cache indent { 0 };
+         auto value = json::parse(text);
+         serialize_to(out, indent, value, 0);
+     } },
+    { "serialize-pretty", [](std::string_view text, null_sink& out) {
+         indent_cache indent { 2 };
+         auto value = json::parse(text);
+         serialize_to(out, indent, value, 0);
+     } },
+    { "stack-formatter", [](std::string_view text, null_sink& out) {
+         formatter stack_based { 2 };
+         auto value = json::parse(text);
+         stack_based.format(out, value);
+     } },
+    { "raw-formatter", [](std::string_view text, null_sink& out) {
+         formatter raw_scalars { 0, formatter::default_max_depth, true };
+         auto value = json::parse(text);
+         raw_scalars.format(out, value);
+     } },
+    { "cbor", [](std::string_view text, null_sink& out) {
+         auto value = json::parse(text);
+         serialize_cbor(out, value);
+     } },
+    { "msgpack", [](std::string_view text, null_sink& out) {
+         auto value = json::parse(text);
+         serialize_msgpack(out, json::tape { value });
+     } },
+    { "document", [](std::string_view text, null_sink& out) {
+         formatter stack_based { 2 };
+         auto value = json::parse(text);
+         stack_based.format(out, json::document { value });
+     } },
+    { "tape", [](std::string_view text, null_sink& out) {
+         formatter stack_based { 2 };
+         auto value = json::parse(text);
+         stack_based.format(out, json::tape { value });
+     } },
+};
+
+// Best of repeated runs, allocations are taken from the first run
+void run_benchmark(const corpus& input, std::size_t tokens, const benchmark& bench, double min_seconds)
+{
+    using clock = std::chrono::steady_clock;
+    null_sink out;
+    const auto allocations_before = allocations.load();
+    bench.run(input.text, out);
+    const auto run_allocations = allocations.load() - allocations_before;
+
+    auto best = clock::duration::max();
+    const auto deadline = clock::now() + std::chrono::duration<double>(min_seconds);
+    for (int runs = 0; runs < 3 || clock::now() < deadline; ++runs) {
+        const auto start = clock::now();
+        bench.run(input.text, out);
+        best = std::min(best, clock::now() - start);
+    }
+
+    const double seconds = std::chrono::duration<double>(best).count();
+    const double megabytes = static_cast<double>(input.text.size()) / 1e6;
+    std::printf("%-26s %-18s %10.1f %10.2f %12.1f\n", input.name.c_str(), bench.name,
+        megabytes / seconds, seconds * 1e9 / static_cast<double>(std::max<std::size_t>(tokens, 1)),
+        static_cast<double>(run_allocations) / megabytes);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+try {
+    double min_seconds = 0.5;
+    std::size_t synthetic_size = 4 << 20;
+    std::vector<corpus> corpora;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg { argv[i] };
+        if (arg == "--min-time" && i + 1 < argc) {
+            min_seconds = std::stod(argv[++i]);
+        } else if (arg == "--size" && i + 1 < argc) {
+            synthetic_size = std::stoul(argv[++i]);
+        } else if (arg.substr(0, 2) != "--") {
+            corpora.push_back(read_corpus(argv[i]));
+        } else {
+            std::printf("Usage:\n%s [--min-time 0.5] [--size 4194304] [corpus.json...]\n", argv[0]);
+            return 0;
+        }
+    }
+    corpora.push_back(make_deep(synthetic_size));
+    corpora.push_back(make_wide(synthetic_size));
+    corpora.push_back(make_numbers(synthetic_size));
+    corpora.push_back(make_strings(synthetic_size));
+
+    std::printf("%s\n%-26s %-18s %10s %10s %12s\n", JSON_SOURCE, "corpus", "benchmark", "MB/s", "ns/token", "allocs/MB");
+    for (const auto& input : corpora) {
+        // Standard corpora use literals the parser doesn't support, bench.sh --fetch derives copies without them
+        const auto validation = json::validate(std::make_unique<json::memory_source>(input.text));
+        if (!validation) {
+            if (is_literal_at(input.text, validation.offset)) {
+                std::printf("%-26s skipped: unsupported literals\n", input.name.c_str());
+            } else {
+                std::printf("%-26s skipped: %s at offset %zu\n", input.name.c_str(), validation.error.c_str(), validation.offset);
+            }
+            continue;
+        }
+        const auto tokens = count_tokens(input.text);
+        for (const auto& bench : benchmarks) {
+            run_benchmark(input, tokens, bench, min_seconds);
+        }
+    }
+    return 0;
+} catch (const json::parse_error& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+}
@@ -0,0 +1,46 @@
+#!/bin/bash
+# Benchmarks every implementation over synthetic corpora and the standard ones found in bench/data:
+# twitter.json, citm_catalog.json and canada.json from https://github.com/simdjson/simdjson-data
+# --fetch downloads them and derives *_numeric.json copies with true, false and null replaced by numbers,
+# which the parser reads, the originals are reported as skipped.
+# ./bench/bench.sh [--fetch] [--min-time 0.5] [--size 4194304]
+cd "$(dirname "$0")/.." || exit 1
+mkdir -p .bin/
+if test "$1" = --fetch
+then
+    shift
+    mkdir -p bench/data
+    for name in twitter citm_catalog canada
+    do
+        if ! test -f "bench/data/$name.json"
+        then
+            curl -sSfL "https://raw.githubusercontent.com/simdjson/simdjson-data/master/jsonexamples/$name.json" -o "bench/data/$name.json.part" \
+                && mv "bench/data/$name.json.part" "bench/data/$name.json" \
+                || { rm -f "bench/data/$name.json.part"; echo "Cannot fetch $name.json"; continue; }
+        fi
+        if jq -e 'any(.. ; type == "boolean" or type == "null")' "bench/data/$name.json" > /dev/null
+        then
+            jq 'walk(if type == "boolean" then (if . then 1 else 0 end) elif type == "null" then 0 else . end)' "bench/data/$name.json" > "bench/data/${name}_numeric.json"
+        fi
+    done
+fi
+corpora=$(ls bench/data/*.json 2>/dev/null)
+run_bench() {
+    local std="$1"
+    local src="$2"
+    local bin="$3"
+    shift 3
+    g++ -O2 -DNDEBUG -Wall -Wextra -std=$std -DJSON_SOURCE="\"../$src\"" bench/bench.cpp -o ".bin/$bin"
+    if test $? -ne 0
+    then
+        echo "Compilation failed for $src with $std. Skipping benchmark."
+        return 1
+    fi
+    # shellcheck disable=SC2086
+    .bin/$bin "$@" $corpora
+    echo
+}
+
+run_bench c++17 json_17.cpp bench_17 "$@"
+run_bench c++23 json_23.cpp bench_23 "$@"
+run_bench c++23 json.cpp bench "$@"
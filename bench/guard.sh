@@ -0,0 +1,89 @@
+#!/bin/bash
+# Fails when time per token of any benchmark grows more than the threshold above a baseline revision.
+# Implementation and bench.cpp of the baseline are taken from git and built the same way as the working tree.
+# Revisions are measured alternately and the best of the runs is compared, so drift of the machine hits both.
+# ns/token is compared rather than MB/s, it keeps its precision on the slowest benchmarks.
+# Baseline is the revision recorded in bench/baseline.ref, it is moved forward when a slowdown is accepted.
+# Missing baseline revision or files fail the guard rather than skip it.
+# ./bench/guard.sh [--baseline revision] [--threshold 15] [--runs 3] [--min-time 0.5] [--size 4194304]
+cd "$(dirname "$0")/.." || exit 1
+mkdir -p .bin/guard/bench
+baseline=$(cat bench/baseline.ref)
+threshold=15
+runs=3
+bench_args=()
+while test $# -gt 0
+do
+    case "$1" in
+    --baseline) baseline="$2"; shift 2 ;;
+    --threshold) threshold="$2"; shift 2 ;;
+    --runs) runs="$2"; shift 2 ;;
+    --min-time | --size) bench_args+=("$1" "$2"); shift 2 ;;
+    *) echo "Usage: $0 [--baseline revision] [--threshold 15] [--runs 3] [--min-time 0.5] [--size 4194304]"; exit 0 ;;
+    esac
+done
+failed=0
+
+run_guard() {
+    local std="$1"
+    local src="$2"
+    local bin="$3"
+    if ! git show "$baseline:$src" > ".bin/guard/$src" 2>/dev/null || ! git show "$baseline:bench/bench.cpp" > .bin/guard/bench/bench.cpp 2>/dev/null
+    then
+        echo "$src or bench/bench.cpp is missing in $baseline, record a revision having them in bench/baseline.ref."
+        failed=1
+        return 1
+    fi
+    # Warnings of the baseline are silenced, they are fixed in the working tree or not at all
+    g++ -O2 -DNDEBUG -w -std=$std -DJSON_SOURCE="\"../$src\"" .bin/guard/bench/bench.cpp -o ".bin/guard/${bin}_baseline" \
+        && g++ -O2 -DNDEBUG -Wall -Wextra -std=$std -DJSON_SOURCE="\"../$src\"" bench/bench.cpp -o ".bin/guard/$bin"
+    if test $? -ne 0
+    then
+        echo "Compilation failed for $src with $std. Skipping guard."
+        failed=1
+        return 1
+    fi
+    : > ".bin/guard/$bin.baseline"
+    : > ".bin/guard/$bin.current"
+    for ((run = 0; run < runs; ++run))
+    do
+        ".bin/guard/${bin}_baseline" "${bench_args[@]}" >> ".bin/guard/$bin.baseline"
+        ".bin/guard/$bin" "${bench_args[@]}" >> ".bin/guard/$bin.current"
+    done
+    # Rows are "corpus benchmark MB/s ns/token allocs/MB", benchmarks missing in either revision are not compared
+    awk -v src="$src" -v threshold="$threshold" '
+        NF == 5 && $3 ~ /^[0-9.]+$/ {
+            key = $1 " " $2
+            if (FILENAME == ARGV[1]) {
+                if (!(key in baseline) || $4 < baseline[key]) baseline[key] = $4
+            } else {
+                if (!(key in current) || $4 < current[key]) current[key] = $4
+                if (!(key in order)) { order[key] = ++count; keys[count] = key }
+            }
+        }
+        END {
+            regressions = 0
+            for (i = 1; i <= count; ++i) {
+                key = keys[i]
+                if (!(key in baseline) || baseline[key] == 0) continue
+                change = (current[key] - baseline[key]) * 100 / baseline[key]
+                regressed = change > threshold
+                regressions += regressed
+                printf "%-12s %-36s %10.2f %10.2f ns/token %+7.1f%%%s\n", src, key, baseline[key], current[key], change, regressed ? "  regression" : ""
+            }
+            exit regressions != 0
+        }' ".bin/guard/$bin.baseline" ".bin/guard/$bin.current" || failed=1
+    echo
+}
+
+# Guard that compares nothing passes nothing, so unknown baseline fails, e.g. after history is rewritten
+if ! git rev-parse --quiet --verify "$baseline^{commit}" > /dev/null
+then
+    echo "Baseline revision $baseline does not exist, record an existing one in bench/baseline.ref or pass --baseline."
+    exit 1
+fi
+echo "Time per token of $baseline and working tree, regression threshold is $threshold%"
+run_guard c++17 json_17.cpp guard_17
+run_guard c++23 json_23.cpp guard_23
+run_guard c++23 json.cpp guard
+exit $failed
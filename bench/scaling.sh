@@ -0,0 +1,90 @@
+#!/bin/bash
+# Measures --parallel NDJSON throughput of every implementation with 1, 2, 4... threads up to --max-threads
+# and reports the speedup and efficiency over one thread. Records are generated once into .bin/scaling.ndjson,
+# output goes to /dev/null and the best of --runs is taken. Thread counts above the CPU count are marked,
+# as they cannot scale.
+# ./bench/scaling.sh [--max-threads 16] [--size 268435456] [--runs 3] [--chunk-size 1048576]
+cd "$(dirname "$0")/.." || exit 1
+mkdir -p .bin/
+max_threads=16
+size=$((256 << 20))
+runs=3
+chunk_size=$((1 << 20))
+while test $# -gt 0
+do
+    case "$1" in
+    --max-threads) max_threads="$2"; shift 2 ;;
+    --size) size="$2"; shift 2 ;;
+    --runs) runs="$2"; shift 2 ;;
+    --chunk-size) chunk_size="$2"; shift 2 ;;
+    *) echo "Usage: $0 [--max-threads 16] [--size 268435456] [--runs 3] [--chunk-size 1048576]"; exit 0 ;;
+    esac
+done
+cpus=$(nproc)
+
+# Records of mixed keys, strings, numbers and nesting until the size is reached
+input=.bin/scaling.ndjson
+if ! test -f "$input" || test "$(wc -c < "$input")" -lt "$size"
+then
+    awk -v size="$size" 'BEGIN {
+        for (i = 0; written < size; ++i) {
+            record = sprintf("{\"id\": %d, \"name\": \"user %d\", \"score\": %d.%d, \"tags\": [\"a\", \"b\\n\", \"c\"], \"nested\": {\"x\": %d, \"y\": [1, 2, 3]}}", i, i, i % 1000, i % 7, -i)
+            print record
+            written += length(record) + 1
+        }
+    }' > "$input"
+fi
+bytes=$(wc -c < "$input")
+
+# Best throughput in MB/s over the runs
+measure() {
+    local bin="$1" threads="$2"
+    local best=0 start elapsed
+    for _ in $(seq "$runs")
+    do
+        start=$(date +%s%N)
+        if ! ".bin/$bin" 0 --parallel --threads "$threads" --chunk-size "$chunk_size" --file "$input" > /dev/null
+        then
+            echo 0
+            return 1
+        fi
+        elapsed=$(($(date +%s%N) - start))
+        best=$(awk -v best="$best" -v bytes="$bytes" -v ns="$elapsed" 'BEGIN { mbs = bytes * 1000 / ns; printf "%.1f", (mbs > best ? mbs : best) }')
+    done
+    echo "$best"
+}
+
+run_scaling() {
+    local std="$1"
+    local src="$2"
+    local bin="$3"
+    g++ -O2 -DNDEBUG -std=$std -pthread "$src" -o ".bin/$bin"
+    if test $? -ne 0
+    then
+        echo "Compilation failed for $src with $std. Skipping scaling run."
+        return 1
+    fi
+    local single="" threads=1 mbs note
+    while test "$threads" -le "$max_threads"
+    do
+        if ! mbs=$(measure "$bin" "$threads")
+        then
+            printf '%-12s %3d threads failed\n' "$bin" "$threads"
+            return 1
+        fi
+        single=${single:-$mbs}
+        note=""
+        if test "$threads" -gt "$cpus"
+        then
+            note=" (more threads than $cpus CPUs)"
+        fi
+        awk -v bin="$bin" -v threads="$threads" -v mbs="$mbs" -v single="$single" -v note="$note" \
+            'BEGIN { printf "%-12s %3d threads %10.1f MB/s %6.2fx speedup %5.0f%% efficiency%s\n", bin, threads, mbs, mbs / single, 100 * mbs / single / threads, note }'
+        threads=$((threads * 2))
+    done
+    echo
+}
+
+run_scaling c++17 json_17.cpp scaling_17
+run_scaling c++23 json_23.cpp scaling_23
+run_scaling c++23 json.cpp scaling
@@ -0,0 +1,131 @@
+#!/bin/bash
+# Streams huge inputs through every implementation under memory and time limits:
+# 1e6 levels of nesting, 1 GiB string and array of 1e8 numbers at scale 1.
+# Inputs are generated into a pipe, so the parser can't map them as a whole. Memory limit grows
+# with nesting depth only, except for the string which is a single token and is kept whole.
+# Every case is run at 1/8 of its size too, and the full size must keep at least half of that
+# throughput, so time growing faster than input fails as well.
+# ./bench/stress.sh [--scale 1]
+cd "$(dirname "$0")/.." || exit 1
+mkdir -p .bin/
+scale=1
+while test $# -gt 0
+do
+    case "$1" in
+    --scale) scale="$2"; shift 2 ;;
+    *) echo "Usage: $0 [--scale 1]"; exit 0 ;;
+    esac
+done
+failed=0
+
+# Generators of inputs of the given size
+deep() {
+    head -c "$1" /dev/zero | tr '\0' '['
+    head -c "$1" /dev/zero | tr '\0' ']'
+}
+long_string() {
+    printf '"'
+    head -c "$1" /dev/zero | tr '\0' 'x'
+    printf '"'
+}
+numbers() {
+    printf '['
+    yes '1,' | head -n $(($1 - 1)) | tr -d '\n'
+    printf '1]'
+}
+
+# Input bytes of generator for the given size
+input_size() {
+    case "$1" in
+    deep) echo $((2 * $2)) ;;
+    long_string) echo $(($2 + 2)) ;;
+    numbers) echo $((2 * $2 + 1)) ;;
+    esac
+}
+
+# Prints throughput in MB/s, or fails when output size, exit status, memory or time limit is wrong.
+# Limits are applied to the parser process only, time limit allows 2 MB/s plus startup.
+measure() {
+    local bin="$1" generator="$2" size="$3" memory_mib="$4" mode="$5"
+    local bytes expected start written status elapsed
+    bytes=$(input_size "$generator" "$size")
+    case "$mode" in
+    --validate) expected=0 ;;
+    --output*) expected="" ;;
+    *) expected=$((bytes + 1)) ;;
+    esac
+    start=$(date +%s%N)
+    # shellcheck disable=SC2086
+    written=$($generator "$size" | (
+        ulimit -v $((memory_mib * 1024))
+        timeout $((10 + bytes / 2000000)) ".bin/$bin" 0 ${mode#default} 2>/dev/null
+        echo $? > ".bin/$bin.status"
+    ) | wc -c)
+    elapsed=$(($(date +%s%N) - start))
+    status=$(cat ".bin/$bin.status")
+    if test "$status" -ne 0
+    then
+        echo "exit status $status"
+        return 1
+    fi
+    if test -n "$expected" && test "$written" -ne "$expected"
+    then
+        echo "$written bytes written instead of $expected"
+        return 1
+    fi
+    awk -v bytes="$bytes" -v ns="$elapsed" 'BEGIN { printf "%.1f\n", bytes * 1000 / ns }'
+}
+
+# Size at scale 1 multiplied by the scale
+scaled() {
+    awk -v scale="$scale" -v size="$1" 'BEGIN { printf "%d", scale * size }'
+}
+
+# Runs generator at full and 1/8 size in every mode, memory limit is given in MiB for the full size
+run_case() {
+    local bin="$1" generator="$2" size="$3" memory_mib="$4"
+    shift 4
+    local full small
+    for mode in "$@"
+    do
+        full=""
+        if ! small=$(measure "$bin" "$generator" $((size / 8)) "$memory_mib" "$mode") \
+            || ! full=$(measure "$bin" "$generator" "$size" "$memory_mib" "$mode")
+        then
+            printf '%-16s %-12s %-18s failed: %s\n' "$bin" "$generator" "$mode" "${full:-$small}"
+            failed=1
+        elif awk -v full="$full" -v small="$small" 'BEGIN { exit !(full * 2 >= small) }'
+        then
+            printf '%-16s %-12s %-18s %10s MB/s %10s MB/s at 1/8 size\n' "$bin" "$generator" "$mode" "$full" "$small"
+        else
+            printf '%-16s %-12s %-18s failed: %s MB/s is less than half of %s MB/s at 1/8 size\n' "$bin" "$generator" "$mode" "$full" "$small"
+            failed=1
+        fi
+    done
+}
+
+run_stress() {
+    local std="$1"
+    local src="$2"
+    local bin="$3"
+    g++ -O2 -DNDEBUG -std=$std "$src" -o ".bin/$bin"
+    if test $? -ne 0
+    then
+        echo "Compilation failed for $src with $std. Skipping stress tests."
+        failed=1
+        return 1
+    fi
+    local depth length elements
+    depth=$(scaled 1000000)
+    length=$(scaled $((1 << 30)))
+    elements=$(scaled 100000000)
+    # Recursive serialize() is left out of the deep case, its depth is limited by the native stack
+    run_case "$bin" deep "$depth" $((64 + depth / 2048)) --stack-formatter --sax --validate "--output cbor"
+    run_case "$bin" long_string "$length" $((64 + 3 * length / 1048576)) default --raw --sax --validate "--output cbor"
+    run_case "$bin" numbers "$elements" 64 default --stack-formatter --raw --sax --validate "--output cbor"
+}
+
+run_stress c++17 json_17.cpp stress_17
+run_stress c++23 json_23.cpp stress_23
+run_stress c++23 json.cpp stress
+exit $failed
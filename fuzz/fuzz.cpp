@@ -0,0 +1,512 @@
+// Fuzzing harness for one of the parser implementations, included as a single translation unit.
+// libFuzzer, or AFL++ through its libFuzzer compatible driver:
+// clang++ -g -O1 -fsanitize=fuzzer,address,undefined -std=c++23 -DJSON_SOURCE='"../json_23.cpp"' fuzz/fuzz.cpp
+// Without libFuzzer -DJSON_FUZZ_MAIN adds a driver replaying files and running generated inputs, see fuzz.sh
+#ifndef JSON_SOURCE
+#error "JSON_SOURCE must name the implementation file"
+#endif
+
+#define JSON_NO_MAIN
+#include JSON_SOURCE
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+// Bound structs cover every member kind: integers narrower than int64_t, optional, nested and repeated structs
+struct binding_item {
+    std::string name;
+    std::optional<int> count;
+};
+JSON_FIELDS(binding_item, name, count)
+
+struct binding_record {
+    int32_t id = 0;
+    uint8_t small = 0;
+    bool flag = false;
+    double ratio = 0;
+    std::vector<binding_item> items;
+    std::optional<std::string> note;
+};
+JSON_FIELDS(binding_record, id, small, flag, ratio, items, note)
+
+namespace {
+
+// Violated property aborts with the input, so every fuzzer driver reports it as a crash
+void check(bool condition, const char* property, std::string_view input)
+{
+    if (!condition) {
+        std::fprintf(stderr, "Property violated: %s\nInput of %zu bytes:\n%.*s\n", property, input.size(), static_cast<int>(input.size()), input.data());
+        std::abort();
+    }
+}
+
+// Hands out 1 to 7 bytes per refill from a buffer overwritten by the next one, as reading sources do,
+// so tokens, escapes, skipped values and validated strings are cut by chunk edges at every position
+class small_chunk_source : public json::source {
+public:
+    explicit small_chunk_source(std::string_view input)
+        : input_ { input }
+    {
+    }
+
+    [[nodiscard]] std::string_view next_chunk() override
+    {
+        size_ = size_ % buffer_.size() + 1;
+        const auto chunk = input_.substr(0, size_);
+        input_.remove_prefix(chunk.size());
+        std::copy(chunk.begin(), chunk.end(), buffer_.begin());
+        return { buffer_.data(), chunk.size() };
+    }
+
+private:
+    std::string_view input_;
+    std::array<char, 7> buffer_ {};
+    std::size_t size_ = 0;
+};
+
+// Whole input as one chunk, or small chunks
+std::unique_ptr<json::source> source_of(std::string_view input, bool small_chunks)
+{
+    if (small_chunks) {
+        return std::make_unique<small_chunk_source>(input);
+    }
+    return std::make_unique<json::memory_source>(input);
+}
+
+struct outcome {
+    std::string output;
+    // Empty when the value was formatted completely
+    std::string error;
+    std::size_t offset = 0;
+};
+
+// Formats the input, consuming the whole value even when errors are recorded instead of thrown
+outcome format_input(std::string_view input, uint16_t indent_base, bool throw_errors, bool raw_scalars = false, bool small_chunks = false)
+{
+    json::parser_options options;
+    options.throw_errors = throw_errors;
+    json::parser parser { source_of(input, small_chunks), options };
+    json::string_sink out;
+    try {
+        auto value = parser.parse();
+        formatter stack_based { indent_base, formatter::default_max_depth, raw_scalars };
+        stack_based.format(out, value);
+    } catch (const json::parse_error& e) {
+        return { out.take(), e.what() };
+    }
+    if (const auto& error = parser.last_error()) {
+        return { out.take(), json::parse_error { *error }.what(), error->offset };
+    }
+    return { out.take(), {} };
+}
+
+// Implementations differ in serialize() interface: C++17 writes into sink, C++23 yields chunks
+template <typename Value>
+auto serialize_to(json::sink& out, indent_cache& indent, Value& value, int) -> decltype(serialize(out, indent, value), void())
+{
+    serialize(out, indent, value);
+}
+
+template <typename Value>
+void serialize_to(json::sink& out, indent_cache& indent, Value& value, long)
+{
+    for (auto chunk : serialize(indent, value)) {
+        out.append(chunk);
+    }
+}
+
+std::string serialize_compact(std::string_view input)
+{
+    indent_cache indent { 0 };
+    json::string_sink out;
+    auto value = json::parse(input);
+    serialize_to(out, indent, value, 0);
+    return out.take();
+}
+
+// Events are fed in fragments of every size up to 7 bytes, so tokens are cut at every position.
+// Input is fed until an error is recorded, so data after the value is checked as validation does.
+outcome push_compact(std::string_view input)
+{
+    json::string_sink out;
+    event_formatter events { out, 0 };
+    json::parser_options options;
+    options.throw_errors = false;
+    json::push_parser<event_formatter&> parser { events, options };
+    const auto step = 1 + input.size() % 7;
+    for (std::size_t i = 0; i < input.size() && !parser.last_error(); i += step) {
+        parser.feed(input.substr(i, step));
+    }
+    parser.finish();
+    if (const auto& error = parser.last_error()) {
+        return { out.take(), json::parse_error { *error }.what(), error->offset };
+    }
+    return { out.take(), {} };
+}
+
+std::string sax_compact(std::string_view input, bool small_chunks = false)
+{
+    json::string_sink out;
+    event_formatter events { out, 0 };
+    json::lexer lexer { source_of(input, small_chunks) };
+    json::parse_events(lexer, events);
+    return out.take();
+}
+
+// Binding consumes the object or throws, whatever the input is.
+// Keys of generated documents are unknown, so their values are skipped. Returns the error.
+std::string bind_any(std::string_view input, bool small_chunks = false)
+{
+    try {
+        auto value = json::parse(source_of(input, small_chunks));
+        static_cast<void>(json::bind<binding_record>(value));
+    } catch (const json::parse_error& e) {
+        return e.what();
+    }
+    return {};
+}
+
+void fuzz_one(std::string_view input)
+{
+    const auto validation = json::validate(std::make_unique<json::memory_source>(input));
+    const auto thrown = format_input(input, 0, true);
+    const auto recorded = format_input(input, 0, false);
+
+    // Small chunks give the same output and errors as a single one
+    const auto chunked_validation = json::validate(source_of(input, true));
+    check(static_cast<bool>(chunked_validation) == static_cast<bool>(validation) && chunked_validation.error == validation.error
+            && chunked_validation.offset == validation.offset,
+        "validation of small chunks differs", input);
+    const auto chunked_thrown = format_input(input, 0, true, false, true);
+    const auto chunked_recorded = format_input(input, 0, false, false, true);
+    check(chunked_thrown.output == thrown.output && chunked_thrown.error == thrown.error, "output of small chunks differs", input);
+    check(chunked_recorded.output == recorded.output && chunked_recorded.error == recorded.error && chunked_recorded.offset == recorded.offset,
+        "recorded error of small chunks differs", input);
+    check(bind_any(input, true) == bind_any(input), "binding of small chunks differs", input);
+
+    // Push parser rejects the same inputs, data after the value included. Escape errors are
+    // reported at the closing quote, so only the presence of an error is compared.
+    const auto pushed = push_compact(input);
+    check(pushed.error.empty() == validation.error.empty(), "push parser accepts different input", input);
+
+    // Recorded error is the thrown one, output stops at the same place and only closes containers after it
+    check(thrown.error == recorded.error, "recorded error differs from thrown one", input);
+    check(recorded.output.compare(0, thrown.output.size(), thrown.output) == 0, "output before recorded error differs", input);
+    // Validation checks the same grammar, but parser ignores data after the value
+    if (!recorded.error.empty()) {
+        check(validation.error == recorded.error && validation.offset == recorded.offset, "validation reports different error", input);
+        return;
+    }
+    if (!validation) {
+        return;
+    }
+
+    // Compact output is valid and formatted again unchanged, by every formatting path
+    const auto& compact = thrown.output;
+    check(static_cast<bool>(json::validate(std::make_unique<json::memory_source>(compact))), "compact output is invalid", input);
+    check(format_input(compact, 0, true).output == compact, "compact output is not formatted unchanged", input);
+    check(serialize_compact(input) == compact, "serialize() output differs from formatter", input);
+    check(sax_compact(input) == compact, "SAX output differs from formatter", input);
+    check(sax_compact(input, true) == compact, "SAX output of small chunks differs from formatter", input);
+    check(pushed.output == compact, "push parser output differs from formatter", input);
+    check(format_input(format_input(input, 2, true).output, 0, true).output == compact, "pretty output differs from compact one", input);
+
+    // Raw scalars are valid tokens of the same values
+    const auto raw = format_input(input, 0, true, true);
+    check(raw.error.empty() && static_cast<bool>(json::validate(std::make_unique<json::memory_source>(raw.output))), "raw output is invalid", input);
+    check(format_input(raw.output, 0, true).output == compact, "raw output has different values", input);
+    check(format_input(input, 0, true, true, true).output == raw.output, "raw output of small chunks differs", input);
+
+    // Binary encodings of streams and tapes
+    json::string_sink binary;
+    auto value = json::parse(input);
+    serialize_cbor(binary, value);
+    auto tape_value = json::parse(input);
+    const json::tape tape { tape_value };
+    serialize_cbor(binary, tape);
+    serialize_msgpack(binary, tape);
+    check(!binary.take().empty(), "binary output is empty", input);
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size)
+{
+    // Deeper nesting than formatter::default_max_depth is rejected by formatters only, not by validation
+    if (size < formatter::default_max_depth) {
+        fuzz_one({ reinterpret_cast<const char*>(data), size });
+    }
+    return 0;
+}
+
+#ifdef JSON_FUZZ_MAIN
+namespace {
+
+// Random documents of the JSON subset jq formats the same way:
+// no literals, unique keys, integers exactly representable as double and doubles within range
+class generator {
+public:
+    explicit generator(uint64_t seed)
+        : random_ { seed }
+    {
+    }
+
+    // Root scalar is converted by json::parse(), so raw formatting keeps values of container roots only
+    [[nodiscard]] std::string document(bool container_root = false)
+    {
+        std::string out;
+        whitespace(out);
+        // Long chains check nesting, jq parses up to 256 levels
+        if (random_() % 32 == 0) {
+            const auto depth = 1 + random_() % 199;
+            out.append(depth, '[');
+            value(out, 0);
+            out.append(depth, ']');
+        } else if (container_root) {
+            container(out, 0, random_() % 2);
+        } else {
+            value(out, 0);
+        }
+        whitespace(out);
+        return out;
+    }
+
+    // Valid document with some bytes replaced, inserted or erased, or cut off
+    [[nodiscard]] std::string mutation()
+    {
+        static constexpr std::string_view interesting = "{}[],:\"\\/ubfnrt0123456789.-+eE \n\x7f\xc3\xa9\xff";
+        auto out = document();
+        for (auto edits = 1 + random_() % 4; edits != 0 && !out.empty(); --edits) {
+            const auto at = random_() % out.size();
+            const char byte = random_() % 4 ? interesting[random_() % interesting.size()] : static_cast<char>(random_());
+            switch (random_() % 4) {
+            case 0:
+                out[at] = byte;
+                break;
+            case 1:
+                out.insert(out.begin() + static_cast<std::ptrdiff_t>(at), byte);
+                break;
+            case 2:
+                out.erase(at, 1 + random_() % 8);
+                break;
+            default:
+                out.resize(at);
+                break;
+            }
+        }
+        return out;
+    }
+
+private:
+    void value(std::string& out, int depth)
+    {
+        switch (random_() % (depth < 6 ? 5 : 3)) {
+        case 0:
+            string(out);
+            break;
+        case 1:
+            integer(out);
+            break;
+        case 2:
+            decimal(out);
+            break;
+        case 3:
+            container(out, depth, true);
+            break;
+        default:
+            container(out, depth, false);
+            break;
+        }
+    }
+
+    void container(std::string& out, int depth, bool is_object)
+    {
+        out += is_object ? '{' : '[';
+        const auto size = random_() % 6;
+        for (std::size_t i = 0; i < size; ++i) {
+            if (i != 0) {
+                out += ',';
+            }
+            whitespace(out);
+            if (is_object) {
+                // Suffix keeps keys unique after decoding
+                string(out, "_" + std::to_string(i));
+                whitespace(out);
+                out += ':';
+                whitespace(out);
+            }
+            value(out, depth + 1);
+            whitespace(out);
+        }
+        if (size == 0) {
+            whitespace(out);
+        }
+        out += is_object ? '}' : ']';
+    }
+
+    void string(std::string& out, std::string_view suffix = {})
+    {
+        static constexpr std::string_view pieces[] = {
+            "a", "key", "Value 1", " ", "\\\"", "\\\\", "\\/", "\\b\\f\\n\\r\\t", "\\u00e9", "\\u001f",
+            "\\u0000", "\\ud83d\\ude00", "\\u20AC", "\xc3\xa9", "\xf0\x9f\x98\x80", "]}\\\"", "\\\\u0041"
+        };
+        out += '"';
+        for (auto count = random_() % 5; count != 0; --count) {
+            out += pieces[random_() % std::size(pieces)];
+        }
+        out += suffix;
+        out += '"';
+    }
+
+    void integer(std::string& out)
+    {
+        const auto magnitude = static_cast<int64_t>(random_() >> (11 + random_() % 53));
+        out += magnitude != 0 && random_() % 2 ? "-" : "";
+        out += std::to_string(magnitude);
+    }
+
+    void decimal(std::string& out)
+    {
+        out += random_() % 2 ? "-" : "";
+        out += std::to_string(random_() % 1000000);
+        if (random_() % 4) {
+            out += '.';
+            for (auto digits = 1 + random_() % 12; digits != 0; --digits) {
+                out += static_cast<char>('0' + random_() % 10);
+            }
+        }
+        if (random_() % 2) {
+            out += random_() % 2 ? 'e' : 'E';
+            const char* const signs[] = { "", "+", "-" };
+            out += signs[random_() % 3];
+            out += std::to_string(random_() % 290);
+        } else if (out.find('.') == std::string::npos) {
+            out += ".5";
+        }
+    }
+
+    void whitespace(std::string& out)
+    {
+        static constexpr std::string_view spaces[] = { "", "", "", " ", "\n", "\t ", "\r\n  " };
+        out += spaces[random_() % std::size(spaces)];
+    }
+
+    std::mt19937_64 random_;
+};
+
+// Error message of binding the input, empty when it is bound into out
+std::string bind_error(std::string_view input, binding_record& out)
+{
+    try {
+        auto value = json::parse(input);
+        out = json::bind<binding_record>(value);
+    } catch (const json::parse_error& e) {
+        return e.what();
+    }
+    return {};
+}
+
+// Fixed binding cases, generated documents have no keys of the bound structs
+void check_binding()
+{
+    binding_record out;
+    const std::string_view input = R"({"extra": {"id": [1, {"x": "]"}]}, "items": [{"count": 3, "name": "a"}, {"name": "b", "more": 1}], "ratio": 2, "id": -5})";
+    check(bind_error(input, out).empty(), "binding fails", input);
+    // Keys in any order, unknown ones skipped with nested values, missing members keep their values
+    check(out.id == -5 && out.ratio == 2 && out.small == 0 && !out.flag && !out.note, "bound scalars differ", input);
+    check(out.items.size() == 2 && out.items[0].name == "a" && out.items[0].count == 3 && out.items[1].name == "b" && !out.items[1].count,
+        "bound nested structs differ", input);
+
+    const std::pair<std::string_view, std::string_view> errors[] = {
+        { R"({"id": "7"})", "Unexpected type of field: id" },
+        { R"({"items": [{"name": 1}]})", "Unexpected type of field: name" },
+        { R"({"items": {}})", "Unexpected type of field: items" },
+        { R"({"note": 1.5})", "Unexpected type of field: note" },
+        // Integers are not narrowed and no integer is a bool
+        { R"({"id": 4294967297})", "Value out of range of field: id" },
+        { R"({"small": 256})", "Value out of range of field: small" },
+        { R"({"small": -1})", "Value out of range of field: small" },
+        { R"({"items": [{"count": 2147483648}]})", "Value out of range of field: count" },
+        { R"({"flag": 7})", "Unexpected type of field: flag" },
+        { R"([1])", "Expected object" },
+    };
+    for (const auto& [bad, message] : errors) {
+        check(bind_error(bad, out) == "JSON parse error: " + std::string(message), "binding reports different error", bad);
+    }
+}
+
+// Full key pool still finds its keys, new ones are passed through with the uninterned id
+void check_key_pool()
+{
+    json::key_pool keys { 3, 8 };
+    const std::string_view input = "a bb ccc dddd";
+    const auto a = keys.intern("a");
+    check(a.id == 0 && keys.intern("bb").id == 1 && keys.intern("ccc").id == 2, "keys get sequential ids", input);
+    const std::string fourth = "dddd";
+    const auto past_count = keys.intern(fourth);
+    check(past_count.id == json::key_pool::uninterned && past_count.text.data() == fourth.data(), "key past the count limit is interned", input);
+    check(keys.intern(std::string { "a" }).text.data() == a.text.data() && keys.size() == 3, "full pool does not find its keys", input);
+
+    json::key_pool small { 10, 4 };
+    check(small.intern("abc").id == 0 && small.intern("de").id == json::key_pool::uninterned && small.intern("f").id == 1,
+        "byte limit of the pool differs", "abc de f");
+    json::key_pool none { 0 };
+    check(none.intern("a").id == json::key_pool::uninterned, "pool without room interns", "a");
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+try {
+    std::size_t cases = 0;
+    std::size_t documents = 0;
+    uint64_t seed = 1;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg { argv[i] };
+        if (arg == "--generate" && i + 1 < argc) {
+            cases = std::stoul(argv[++i]);
+        } else if (arg == "--print" && i + 1 < argc) {
+            documents = std::stoul(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoull(argv[++i]);
+        } else if (arg.substr(0, 2) != "--") {
+            files.emplace_back(arg);
+        } else {
+            std::printf("Usage:\n%s [--generate 10000] [--print 1000] [--seed 1] [input...]\n", argv[0]);
+            return 0;
+        }
+    }
+    check_binding();
+    check_key_pool();
+    const auto run = [](const std::string& input) {
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    };
+    // Replays corpus or crash files
+    for (const auto& path : files) {
+        std::ifstream file { path, std::ios::binary };
+        if (!file) {
+            throw json::parse_error { "Cannot open " + path };
+        }
+        std::ostringstream text;
+        text << file.rdbuf();
+        run(text.str());
+    }
+    // Valid documents alternate with mutated ones
+    generator inputs { seed };
+    for (std::size_t i = 0; i < cases; ++i) {
+        run(i % 2 ? inputs.mutation() : inputs.document());
+    }
+    // Documents for differential comparison, one after another
+    for (std::size_t i = 0; i < documents; ++i) {
+        std::printf("%s\n", inputs.document(true).c_str());
+    }
+    return 0;
+} catch (const json::parse_error& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+}
+#endif
@@ -0,0 +1,59 @@
+#!/bin/bash
+# Runs the fuzzing harness for every implementation under address and undefined behavior sanitizers,
+# then compares values of generated documents formatted by every implementation with jq.
+# Formatting itself is compared with jq by tests.sh, jq prints empty containers as [] while formatters open them.
+# ./fuzz/fuzz.sh [--cases 20000] [--seed 1]
+# Coverage guided fuzzing with clang and libFuzzer, seeded by the generated documents:
+# ./fuzz/fuzz.sh --libfuzzer 60
+cd "$(dirname "$0")/.." || exit 1
+mkdir -p .bin/fuzz/
+cases=20000
+seed=1
+libfuzzer_seconds=0
+while test $# -gt 0
+do
+    case "$1" in
+    --cases) cases="$2"; shift 2 ;;
+    --seed) seed="$2"; shift 2 ;;
+    --libfuzzer) libfuzzer_seconds="$2"; shift 2 ;;
+    *) echo "Usage: $0 [--cases 20000] [--seed 1] [--libfuzzer seconds]"; exit 0 ;;
+    esac
+done
+failed=0
+run_fuzz() {
+    local std="$1"
+    local src="$2"
+    local bin="$3"
+    # Rest of arguments are formatting modes compared with jq
+    g++ -g -O1 -fsanitize=address,undefined -fno-sanitize-recover=all -std=$std -DJSON_FUZZ_MAIN -DJSON_SOURCE="\"../$src\"" fuzz/fuzz.cpp -o ".bin/fuzz/$bin"
+    if test $? -ne 0
+    then
+        echo "Compilation failed for $src with $std. Skipping fuzzing."
+        failed=1
+        return 1
+    fi
+    .bin/fuzz/$bin --generate "$cases" --seed "$seed" || { echo "Fuzzing failed for $src"; failed=1; }
+    # Generated documents are parsed one after another, values are compared after jq parses both outputs
+    .bin/fuzz/$bin --print $((cases / 10)) --seed "$seed" > ".bin/fuzz/$bin.ndjson"
+    g++ -O1 -std=$std "$src" -o ".bin/fuzz/${bin}_cli" || { failed=1; return 1; }
+    shift 3
+    for mode in "$@"
+    do
+        # shellcheck disable=SC2086
+        .bin/fuzz/${bin}_cli 2 --ndjson ${mode#default} --file ".bin/fuzz/$bin.ndjson" | jq -c . | cmp -s - <(jq -c . ".bin/fuzz/$bin.ndjson") \
+            || { echo "Values formatted from $src in $mode mode differ from jq, see .bin/fuzz/$bin.ndjson"; failed=1; }
+    done
+    if test "$libfuzzer_seconds" -gt 0
+    then
+        clang++ -g -O1 -fsanitize=fuzzer,address,undefined -std=$std -DJSON_SOURCE="\"../$src\"" fuzz/fuzz.cpp -o ".bin/fuzz/${bin}_libfuzzer" || { failed=1; return 1; }
+        mkdir -p ".bin/fuzz/${bin}_corpus"
+        split -l 1 ".bin/fuzz/$bin.ndjson" ".bin/fuzz/${bin}_corpus/seed_"
+        .bin/fuzz/${bin}_libfuzzer -max_total_time="$libfuzzer_seconds" -artifact_prefix=".bin/fuzz/${bin}_" ".bin/fuzz/${bin}_corpus" 2>/dev/null \
+            || { echo "libFuzzer found a crash in $src, see .bin/fuzz/${bin}_crash-*"; failed=1; }
+    fi
+}
+
+run_fuzz c++17 json_17.cpp json_17 default --stack-formatter --raw
+run_fuzz c++23 json_23.cpp json_23 default --stack-formatter --raw
+run_fuzz c++23 json.cpp json default --stack-formatter --raw
+exit $failed
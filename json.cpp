@@ -1,24 +1,171 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
 #include <cctype>
+#include <cerrno>
+#include <cfloat>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <exception>
+#include <expected>
 #include <functional>
+#include <future>
 #include <generator>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <ostream>
 #include <print>
 #include <ranges>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <unordered_set>
 #include <utility>
 #include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#ifdef __cpp_exceptions
+#define JSON_EXCEPTIONS 1
+#else
+#define JSON_EXCEPTIONS 0
+#endif
+
+// Without exceptions (-fno-exceptions) try blocks are plain blocks and their handlers are discarded
+#if JSON_EXCEPTIONS
+#define JSON_TRY try
+#define JSON_CATCH(exception) catch (exception)
+#else
+#define JSON_TRY if (true)
+#define JSON_CATCH(exception) if (false)
+#endif
 
 namespace json {
 
+// Parsing errors, reported by value when they are not thrown, see parser_options::throw_errors
+enum class error_code : uint8_t {
+    UNEXPECTED_CHARACTER,
+    UNEXPECTED_END_OF_INPUT,
+    UNEXPECTED_DATA_AFTER_VALUE,
+    UNTERMINATED_STRING,
+    INVALID_ESCAPE,
+    INVALID_UNICODE_ESCAPE,
+    UNPAIRED_SURROGATE,
+    UNESCAPED_CONTROL_CHARACTER,
+    EXPECTED_DIGIT,
+    LEADING_ZEROS,
+    EXPECTED_FRACTION_DIGIT,
+    EXPECTED_EXPONENT_DIGIT,
+    MULTIPLE_DECIMAL_POINTS,
+    UNEXPECTED_CHARACTER_IN_NUMBER,
+    NUMBER_OUT_OF_RANGE,
+    EXPECTED_VALUE,
+    EXPECTED_OBJECT,
+    EXPECTED_ARRAY,
+    EXPECTED_KEY,
+    EXPECTED_COLON,
+    EXPECTED_PAIR_SEPARATOR,
+    EXPECTED_ELEMENT_SEPARATOR,
+    READ_ERROR,
+    WRITE_ERROR,
+};
+
+struct error {
+    error_code code;
+    // Byte offset in the input where the error was detected
+    std::size_t offset = 0;
+    // Offending character, only for the codes naming one
+    char character = 0;
+    // errno of the failed system call, only for I/O errors
+    int system_error = 0;
+
+    [[nodiscard]] std::string message() const
+    {
+        switch (code) {
+        case error_code::UNEXPECTED_CHARACTER:
+            return "Unexpected character: " + std::string(1, character);
+        case error_code::UNEXPECTED_END_OF_INPUT:
+            return "Unexpected end of input";
+        case error_code::UNEXPECTED_DATA_AFTER_VALUE:
+            return "Unexpected data after value";
+        case error_code::UNTERMINATED_STRING:
+            return "Unterminated string";
+        case error_code::INVALID_ESCAPE:
+            return "Invalid escape in string: \\" + std::string(1, character);
+        case error_code::INVALID_UNICODE_ESCAPE:
+            return "Invalid unicode escape in string";
+        case error_code::UNPAIRED_SURROGATE:
+            return "Unpaired surrogate in string";
+        case error_code::UNESCAPED_CONTROL_CHARACTER:
+            return "Unescaped control character in string";
+        case error_code::EXPECTED_DIGIT:
+            return "Expected digit in number";
+        case error_code::LEADING_ZEROS:
+            return "Leading zeros in number";
+        case error_code::EXPECTED_FRACTION_DIGIT:
+            return "Expected digit after decimal point";
+        case error_code::EXPECTED_EXPONENT_DIGIT:
+            return "Expected digit in exponent";
+        case error_code::MULTIPLE_DECIMAL_POINTS:
+            return "Multiple decimal points in number";
+        case error_code::UNEXPECTED_CHARACTER_IN_NUMBER:
+            return "Unexpected character in number: " + std::string(1, character);
+        case error_code::NUMBER_OUT_OF_RANGE:
+            return "Number out of range";
+        case error_code::EXPECTED_VALUE:
+            return "Expected value";
+        case error_code::EXPECTED_OBJECT:
+            return "Expected '{'";
+        case error_code::EXPECTED_ARRAY:
+            return "Expected '['";
+        case error_code::EXPECTED_KEY:
+            return "Expected string key";
+        case error_code::EXPECTED_COLON:
+            return "Expected ':' after key";
+        case error_code::EXPECTED_PAIR_SEPARATOR:
+            return "Expected ',' between object pairs";
+        case error_code::EXPECTED_ELEMENT_SEPARATOR:
+            return "Expected ',' between array elements";
+        case error_code::READ_ERROR:
+            return "Read error: " + std::string(std::strerror(system_error));
+        case error_code::WRITE_ERROR:
+            return "Write error: " + std::string(std::strerror(system_error));
+        }
+        std::unreachable();
+    }
+};
+
 class parse_error : public std::exception {
 public:
     explicit parse_error(std::string message)
@@ -26,6 +173,11 @@ public:
     {
     }
 
+    explicit parse_error(const error& e)
+        : parse_error { e.message() }
+    {
+    }
+
     [[nodiscard]] const char* what() const noexcept override
     {
         return message_.c_str();
@@ -35,408 +187,5471 @@ private:
     const std::string message_;
 };
 
-// Lexer outputs a sequence of tokens - language's basic primitives, without verifying any grammatics.
-class lexer {
-public:
-    enum class token_type {
-        STRING,
-        NUMBER,
-        OBJECT_BEGIN, // {
-        OBJECT_END, // }
-        ARRAY_BEGIN, // [
-        ARRAY_END, // ]
-        COMMA, // ,
-        COLON, // :
-        NOOP, // special value to skip parsing step
-        END_OF_INPUT,
-    };
+// Throws the error, without exceptions it is reported and the process is aborted
+[[noreturn]] inline void raise(const parse_error& e)
+{
+#if JSON_EXCEPTIONS
+    throw e;
+#else
+    std::cerr << e.what() << "\n";
+    std::abort();
+#endif
+}
 
-    using token_value = std::variant<int64_t, double, std::string>;
+inline constexpr std::size_t default_chunk_size = 64 * 1024;
 
-    struct token {
-        token_type type;
-        std::optional<token_value> value;
-    };
+// Input source feeds lexer with contiguous chunks of bytes.
+// Lexer scans chunk with raw pointers and asks source for the next one only at chunk edge.
+class source {
+public:
+    virtual ~source() = default;
 
-    explicit lexer(std::istreambuf_iterator<char>&& input)
-        : input_ { std::move(input) }
+    // Get next chunk of input. Empty chunk means end of input.
+    // Previously returned chunk is invalidated.
+    [[nodiscard]] virtual std::string_view next_chunk() = 0;
+
+    // errno of the failed read which ended the input, zero at the real end.
+    // Lexer reports it as error_code::READ_ERROR, so it is thrown or recorded as parsing errors are.
+    [[nodiscard]] int read_error() const noexcept
     {
+        return read_error_;
     }
 
-    lexer(const lexer&) = delete;
-    lexer operator=(const lexer&) = delete;
-    lexer(lexer&&) = default;
-    lexer& operator=(lexer&&) = default;
+protected:
+    int read_error_ = 0;
+};
 
-    // Get current token type without consuming it
-    [[nodiscard]] token_type peek_type()
+// Reads file descriptor by fixed-size chunks with read(2)
+class fd_source : public source {
+public:
+    explicit fd_source(int fd, std::size_t chunk_size = default_chunk_size)
+        : fd_ { fd }
+        , buffer_(chunk_size)
     {
-        // Skip whitespace characters
-        while (input_ != end_ && std::isspace(*input_)) {
-            ++input_;
-        }
-
-        if (input_ == end_) {
-            return token_type::END_OF_INPUT;
-        }
+    }
 
-        switch (*input_) {
-        case '{':
-            return token_type::OBJECT_BEGIN;
-        case '}':
-            return token_type::OBJECT_END;
-        case '[':
-            return token_type::ARRAY_BEGIN;
-        case ']':
-            return token_type::ARRAY_END;
-        case ',':
-            return token_type::COMMA;
-        case ':':
-            return token_type::COLON;
-        case '"':
-            return token_type::STRING;
-        default:
-            if (std::isdigit(*input_) || *input_ == '-') {
-                return token_type::NUMBER;
+    [[nodiscard]] std::string_view next_chunk() override
+    {
+        for (;;) {
+            if (auto size = ::read(fd_, buffer_.data(), buffer_.size()); size >= 0) {
+                return { buffer_.data(), static_cast<std::size_t>(size) };
+            }
+            if (errno != EINTR) {
+                read_error_ = errno;
+                return {};
             }
-            throw parse_error { "Unexpected character: " + std::string(1, *input_) };
         }
     }
 
-    // Consume current token
-    [[nodiscard]] token next_token()
-    {
-        token_type type = peek_type();
+private:
+    int fd_;
+    std::vector<char> buffer_;
+};
 
-        switch (type) {
-        case token_type::OBJECT_BEGIN:
-        case token_type::OBJECT_END:
-        case token_type::ARRAY_BEGIN:
-        case token_type::ARRAY_END:
-        case token_type::COMMA:
-        case token_type::COLON:
-        case token_type::NOOP:
-        case token_type::END_OF_INPUT:
-            if (type != token_type::END_OF_INPUT) {
-                ++input_;
-            }
-            return { type, std::nullopt };
-        case token_type::STRING:
-            return { type, parse_string() };
-        case token_type::NUMBER:
-            return { type, parse_number() };
-        }
-        throw parse_error { "Unexpected token type" };
+// Compatibility source copying std::istreambuf_iterator input into chunks
+class istreambuf_source : public source {
+public:
+    explicit istreambuf_source(std::istreambuf_iterator<char>&& input, std::size_t chunk_size = default_chunk_size)
+        : input_ { std::move(input) }
+        , buffer_(chunk_size)
+    {
     }
 
-    // Consume current token only if it is of expected type
-    [[nodiscard]] std::optional<token> try_consume_token(token_type type)
+    [[nodiscard]] std::string_view next_chunk() override
     {
-        if (token_type::NOOP == type) {
-            return token { token_type::NOOP, std::nullopt };
+        std::size_t size = 0;
+        for (; size < buffer_.size() && input_ != end_; ++input_) {
+            buffer_[size++] = *input_;
         }
-        if (peek_type() != type) {
-            return std::nullopt;
-        }
-        return next_token();
+        return { buffer_.data(), size };
     }
 
 private:
-    [[nodiscard]] token_value parse_string()
-    {
-        ++input_; // Skip opening quote
+    std::istreambuf_iterator<char> input_;
+    static constexpr std::istreambuf_iterator<char> end_ {};
+    std::vector<char> buffer_;
+};
 
-        std::string result;
-        for (; input_ != end_ && *input_ != '"'; ++input_) {
-            result.push_back(*input_);
-        }
-        if (input_ == end_) {
-            throw parse_error { "Unterminated string" };
-        }
+// Source over contiguous memory, lexer scans it as a single chunk without copying
+class memory_source : public source {
+public:
+    explicit memory_source(std::string_view input)
+        : input_ { input }
+    {
+    }
 
-        ++input_; // Skip closing quote
-        return result;
+    [[nodiscard]] std::string_view next_chunk() override
+    {
+        return std::exchange(input_, {});
     }
 
-    [[nodiscard]] token_value parse_number()
+private:
+    std::string_view input_;
+};
+
+// Memory-mapped file, lexer scans the whole mapping as a single chunk.
+// Errors of opening and mapping are thrown, or with `throw_errors = false` they end the input
+// as a read error, which the lexer records with its errno.
+class mapped_file_source : public source {
+public:
+    explicit mapped_file_source(const std::string& path, bool throw_errors = true)
     {
-        std::string number_str;
-        if (*input_ == '-') {
-            number_str.push_back(*input_);
-            ++input_;
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            if (throw_errors) {
+                raise(parse_error { "Cannot open " + path + ": " + std::strerror(errno) });
+            }
+            read_error_ = errno;
+            return;
         }
-
-        bool has_decimal = false;
-        for (; input_ != end_ && (std::isdigit(*input_) || *input_ == '.'); ++input_) {
-            if (*input_ == '.') {
-                if (has_decimal) {
-                    throw parse_error { "Multiple decimal points in number" };
+        struct stat st { };
+        if (const int e = ::fstat(fd, &st) != 0 ? errno : S_ISREG(st.st_mode) ? 0 : S_ISDIR(st.st_mode) ? EISDIR : EINVAL) {
+            ::close(fd);
+            if (throw_errors) {
+                raise(parse_error { "Not a regular file: " + path });
+            }
+            read_error_ = e;
+            return;
+        }
+        if (st.st_size > 0) {
+            void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                const int e = errno;
+                ::close(fd);
+                if (throw_errors) {
+                    raise(parse_error { "Cannot map " + path + ": " + std::strerror(e) });
                 }
-                has_decimal = true;
+                read_error_ = e;
+                return;
             }
-            number_str.push_back(*input_);
+            ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+            mapping_ = { static_cast<const char*>(data), static_cast<std::size_t>(st.st_size) };
         }
+        ::close(fd);
+        input_ = mapping_;
+    }
+    // Copying would unmap the same memory twice
+    mapped_file_source(const mapped_file_source&) = delete;
+    mapped_file_source& operator=(const mapped_file_source&) = delete;
 
-        if (has_decimal) {
-            return std::stod(number_str);
-        } else {
-            return std::stoll(number_str);
+    ~mapped_file_source() override
+    {
+        if (!mapping_.empty()) {
+            ::munmap(const_cast<char*>(mapping_.data()), mapping_.size());
         }
     }
 
-    std::istreambuf_iterator<char> input_;
-    static constexpr std::istreambuf_iterator<char> end_ {};
-};
+    [[nodiscard]] std::string_view next_chunk() override
+    {
+        return std::exchange(input_, {});
+    }
 
-// Forward declarations of parsing support types
-class object_stream;
-class array_stream;
-using json = std::variant<int64_t, double, std::string, object_stream, array_stream>;
-template <typename Value, typename Parser>
-class iterator;
+private:
+    std::string_view mapping_;
+    std::string_view input_;
+};
 
-// Streaming JSON object parser
-class object_stream {
+// Output sink collects formatted output in a contiguous buffer,
+// full buffer is passed to write() at once instead of per-character stream calls.
+class sink {
 public:
-    using value_type = std::pair<std::string, json>;
-    using iterator = ::json::iterator<value_type, object_stream>;
+    explicit sink(std::size_t capacity = default_chunk_size)
+        : buffer_(std::max(capacity, std::size_t { 1 }))
+    {
+    }
+    // Derived sink must be flushed before it is destroyed
+    virtual ~sink() = default;
 
-    explicit object_stream(std::shared_ptr<lexer>&& lex)
-        : lexer_ { std::move(lex) }
+    void append(std::string_view data)
     {
-        // Consume opening brace
-        if (!lexer_->try_consume_token(lexer::token_type::OBJECT_BEGIN)) {
-            throw parse_error { "Expected '{'" };
+        if (data.size() > buffer_.size() - size_) {
+            flush();
+            // Chunk larger than the buffer is written directly
+            if (data.size() >= buffer_.size()) {
+                write(data);
+                return;
+            }
         }
+        std::memcpy(buffer_.data() + size_, data.data(), data.size());
+        size_ += data.size();
     }
-    // Copying would make two parsers consuming the same stream
-    object_stream(const object_stream&) = delete;
-    object_stream& operator=(const object_stream&) = delete;
-    object_stream(object_stream&&) = default;
-    object_stream& operator=(object_stream&&) = default;
 
-    [[nodiscard]] iterator begin();
-    [[nodiscard]] std::default_sentinel_t end();
+    void append(char c)
+    {
+        if (size_ == buffer_.size()) {
+            flush();
+        }
+        buffer_[size_++] = c;
+    }
 
-private:
-    friend iterator;
-    // Get next value checking languages grammatics.
-    // Returns std::nullopt after last value.
-    [[nodiscard]] std::optional<value_type> next_value();
+    void flush()
+    {
+        if (size_ != 0) {
+            write({ buffer_.data(), std::exchange(size_, 0) });
+        }
+    }
+
+    // errno of the first failed write of a sink recording its errors, zero otherwise.
+    // Output after the error is dropped.
+    [[nodiscard]] int write_error() const noexcept
+    {
+        return write_error_;
+    }
+
+protected:
+    virtual void write(std::string_view data) = 0;
 
-    std::shared_ptr<lexer> lexer_;
-    bool first_pair_ = true;
+    int write_error_ = 0;
+
+private:
+    std::vector<char> buffer_;
+    std::size_t size_ = 0;
 };
 
-// Streaming JSON array parser
-class array_stream {
+// Write whole data to file descriptor, retrying interrupted and partial writes.
+// Returns errno of the failed write, zero when everything is written.
+[[nodiscard]] inline int write_all(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        if (auto size = ::write(fd, data.data(), data.size()); size >= 0) {
+            data.remove_prefix(static_cast<std::size_t>(size));
+        } else if (errno != EINTR) {
+            return errno;
+        }
+    }
+    return 0;
+}
+
+// Write error of a sink throwing its errors
+[[noreturn]] inline void raise_write_error(int system_error)
+{
+    raise(parse_error { error { error_code::WRITE_ERROR, 0, 0, system_error } });
+}
+
+// Writes output to file descriptor with write(2).
+// Write errors are thrown, or recorded as write_error() with `throw_errors = false`.
+class fd_sink : public sink {
 public:
-    using value_type = json;
-    using iterator = ::json::iterator<value_type, array_stream>;
+    explicit fd_sink(int fd, std::size_t capacity = default_chunk_size, bool throw_errors = true)
+        : sink { capacity }
+        , fd_ { fd }
+        , throw_errors_ { throw_errors }
+    {
+    }
 
-    explicit array_stream(std::shared_ptr<lexer>&& lex)
-        : lexer_ { std::move(lex) }
+    ~fd_sink() override
     {
-        // Consume opening bracket
-        if (!lexer_->try_consume_token(lexer::token_type::ARRAY_BEGIN)) {
-            throw parse_error { "Expected '['" };
+        JSON_TRY {
+            flush();
+        } JSON_CATCH(const parse_error&) {
+            // Destructor must not throw, call flush() explicitly to get write errors
         }
     }
-    // Copying would make two parsers consuming the same stream
-    array_stream(const array_stream&) = delete;
-    array_stream& operator=(const array_stream&) = delete;
-    array_stream(array_stream&&) = default;
-    array_stream& operator=(array_stream&&) = default;
 
-    [[nodiscard]] iterator begin();
-    [[nodiscard]] std::default_sentinel_t end();
+protected:
+    void write(std::string_view data) override
+    {
+        if (write_error_ != 0) {
+            return;
+        }
+        if (const int e = write_all(fd_, data)) {
+            if (throw_errors_) {
+                raise_write_error(e);
+            }
+            write_error_ = e;
+        }
+    }
 
 private:
-    friend iterator;
-    // Get next value checking languages grammatics.
-    // Returns std::nullopt after last value.
-    [[nodiscard]] std::optional<value_type> next_value();
-
-    std::shared_ptr<lexer> lexer_;
-    bool first_element_ = true;
+    int fd_;
+    bool throw_errors_;
 };
 
-// Implements input_iterator-like interface
-template <typename Value, typename Parser>
-class iterator {
+// Collects output in memory
+class string_sink : public sink {
 public:
-    using value_type = Value;
-    using difference_type = std::ptrdiff_t;
+    using sink::sink;
 
-    iterator() = default;
-    explicit iterator(Parser* parser)
-        : parser_ { parser }
-        , current_value_ { parser_->next_value() }
+    [[nodiscard]] std::string take()
     {
+        flush();
+        return std::exchange(output_, {});
     }
 
-    [[nodiscard]] bool operator==(const std::default_sentinel_t&) const
+protected:
+    void write(std::string_view data) override
     {
-        return !current_value_.has_value();
+        output_.append(data);
     }
 
-    iterator& operator++()
+private:
+    std::string output_;
+};
+
+// Bounded lock-free queue between one producer thread and one consumer thread.
+// Producer waits while the ring is full and consumer while it is empty, which gives back-pressure.
+template <typename T>
+class spsc_ring {
+public:
+    explicit spsc_ring(std::size_t capacity)
+        : slots_(capacity + 1)
     {
-        current_value_ = parser_->next_value();
-        return *this;
     }
 
-    // post-increment to conform std::input_iterator requirements
-    void operator++(int)
+    void push(T value)
     {
-        ++(*this);
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        const auto next = tail + 1 == slots_.size() ? 0 : tail + 1;
+        for (auto head = head_.load(std::memory_order_acquire); head == next; head = head_.load(std::memory_order_acquire)) {
+            head_.wait(head, std::memory_order_acquire);
+        }
+        slots_[tail] = std::move(value);
+        tail_.store(next, std::memory_order_release);
+        tail_.notify_one();
     }
 
-    [[nodiscard]] value_type& operator*() const
+    [[nodiscard]] T pop()
     {
-        return *current_value_;
+        const auto head = head_.load(std::memory_order_relaxed);
+        for (auto tail = tail_.load(std::memory_order_acquire); tail == head; tail = tail_.load(std::memory_order_acquire)) {
+            tail_.wait(tail, std::memory_order_acquire);
+        }
+        T value = std::move(slots_[head]);
+        head_.store(head + 1 == slots_.size() ? 0 : head + 1, std::memory_order_release);
+        head_.notify_one();
+        return value;
     }
 
 private:
-    Parser* parser_ = nullptr;
-    mutable std::optional<value_type> current_value_;
+    std::vector<T> slots_;
+    // Indices are written by different threads, so they are kept on separate cache lines
+    alignas(64) std::atomic<std::size_t> head_ { 0 };
+    alignas(64) std::atomic<std::size_t> tail_ { 0 };
 };
 
-json parse_value(std::shared_ptr<lexer> lexer)
-{
-    lexer::token_type type = lexer->peek_type();
+// Preallocated buffer passed between pipeline stages, buffer without storage marks the end of data
+struct io_buffer {
+    std::vector<char> data;
+    std::size_t size = 0;
+};
 
-    switch (type) {
-    case lexer::token_type::STRING:
-    case lexer::token_type::NUMBER: {
-        auto token = lexer->next_token();
-        if (!token.value) {
-            throw parse_error { "Expected value token to have a value" };
+// Reads file descriptor on its own thread, so read(2) stalls overlap with lexing.
+// Buffers travel to the lexer filled and come back to the reader through a pair of SPSC rings.
+class prefetch_source : public source {
+public:
+    explicit prefetch_source(int fd, std::size_t chunk_size = default_chunk_size, std::size_t buffers = 4)
+        : free_ { buffers }
+        , filled_ { buffers + 1 }
+    {
+        if (::pipe(stop_pipe_) != 0) {
+            raise(parse_error { "Cannot create pipe: " + std::string(std::strerror(errno)) });
         }
-        return std::visit([](auto& v) {
-            return json { std::move(v) };
-        },
-            *token.value);
+        for (std::size_t i = 0; i < buffers; ++i) {
+            free_.push({ std::vector<char>(chunk_size), 0 });
+        }
+        reader_ = std::thread { [this, fd] { read_loop(fd); } };
     }
-    case lexer::token_type::OBJECT_BEGIN:
-        return object_stream { std::move(lexer) };
-    case lexer::token_type::ARRAY_BEGIN:
-        return array_stream { std::move(lexer) };
-    default:
-        throw parse_error { "Expected value" };
+    // Reader thread points to the rings
+    prefetch_source(const prefetch_source&) = delete;
+    prefetch_source& operator=(const prefetch_source&) = delete;
+
+    ~prefetch_source() override
+    {
+        // Reader is woken up from poll(2) by the pipe and from waiting for a free buffer by returned ones
+        stop_.store(true);
+        const char wake = 0;
+        (void)!::write(stop_pipe_[1], &wake, 1);
+        for (release_current(); !finished_; release_current()) {
+            current_ = filled_.pop();
+            finished_ = current_.data.empty();
+        }
+        reader_.join();
+        ::close(stop_pipe_[0]);
+        ::close(stop_pipe_[1]);
     }
-}
 
-auto object_stream::begin() -> iterator { return iterator { this }; }
-auto object_stream::end() -> std::default_sentinel_t { return std::default_sentinel_t {}; }
+    [[nodiscard]] std::string_view next_chunk() override
+    {
+        release_current();
+        if (finished_) {
+            return {};
+        }
+        current_ = filled_.pop();
+        if (current_.data.empty()) {
+            // Reader thread set its errno before pushing the end marker
+            finished_ = true;
+            read_error_ = reader_error_;
+            return {};
+        }
+        return { current_.data.data(), current_.size };
+    }
 
-std::optional<object_stream::value_type> object_stream::next_value()
-{
-    // Check for end of object
-    if (lexer_->try_consume_token(lexer::token_type::OBJECT_END)) {
-        return std::nullopt;
+private:
+    void release_current()
+    {
+        if (!current_.data.empty()) {
+            free_.push(std::exchange(current_, {}));
+        }
     }
-    return lexer_->try_consume_token(std::exchange(first_pair_, false) ? lexer::token_type::NOOP : lexer::token_type::COMMA)
-        .or_else([] -> std::optional<lexer::token> { throw parse_error("Expected ',' between object pairs"); })
-        .and_then([&](const auto&) { return lexer_->try_consume_token(lexer::token_type::STRING); })
-        .or_else([] -> std::optional<lexer::token> { throw parse_error("Expected string key"); })
-        .and_then([&](const auto& tok) { return lexer_->try_consume_token(lexer::token_type::COLON).transform([&](const auto&) { return std::get<std::string>(*tok.value); }); })
-        .or_else([] -> std::optional<std::string> { throw parse_error("Expected ':' after key"); })
-        .transform([&](const auto& key) { return object_stream::value_type(key, parse_value(lexer_)); });
-}
 
-auto array_stream::begin() -> iterator { return iterator { this }; }
-auto array_stream::end() -> std::default_sentinel_t { return std::default_sentinel_t {}; }
+    // Blocks until fd is readable, false when reading is cancelled or failed
+    bool wait_readable(int fd)
+    {
+        pollfd fds[] = { { fd, POLLIN, 0 }, { stop_pipe_[0], POLLIN, 0 } };
+        while (::poll(fds, 2, -1) < 0) {
+            if (errno != EINTR) {
+                reader_error_ = errno;
+                return false;
+            }
+        }
+        return !(fds[1].revents & POLLIN);
+    }
 
-std::optional<json> array_stream::next_value()
-{
-    // Check for end of array
-    if (lexer_->try_consume_token(lexer::token_type::ARRAY_END)) {
-        return std::nullopt;
+    void read_loop(int fd)
+    {
+        for (;;) {
+            auto buffer = free_.pop();
+            if (stop_.load() || !wait_readable(fd)) {
+                break;
+            }
+            ssize_t size = 0;
+            do {
+                size = ::read(fd, buffer.data.data(), buffer.data.size());
+            } while (size < 0 && errno == EINTR);
+            if (size < 0) {
+                reader_error_ = errno;
+                break;
+            }
+            if (size == 0) {
+                break;
+            }
+            buffer.size = static_cast<std::size_t>(size);
+            filled_.push(std::move(buffer));
+        }
+        // Filled ring has room for every buffer and the end marker, so this never waits
+        filled_.push({});
     }
-    return lexer_->try_consume_token(std::exchange(first_element_, false) ? lexer::token_type::NOOP : lexer::token_type::COMMA)
-        .or_else([] -> std::optional<lexer::token> { throw parse_error("Expected ',' between array elements"); })
-        .transform([&](const auto&) { return parse_value(lexer_); });
-}
+
+    spsc_ring<io_buffer> free_;
+    spsc_ring<io_buffer> filled_;
+    io_buffer current_;
+    bool finished_ = false;
+    // errno of the reader thread, read by the consumer after the end marker
+    int reader_error_ = 0;
+    std::atomic<bool> stop_ { false };
+    int stop_pipe_[2] = { -1, -1 };
+    std::thread reader_;
+};
+
+// Writes output on its own thread, so write(2) stalls overlap with formatting.
+// Flushed data is copied into preallocated buffers passed to the writer through SPSC rings.
+class async_fd_sink : public sink {
+public:
+    explicit async_fd_sink(int fd, std::size_t capacity = default_chunk_size, std::size_t buffers = 4, bool throw_errors = true)
+        : sink { capacity }
+        , free_ { buffers }
+        , filled_ { buffers + 1 }
+        , throw_errors_ { throw_errors }
+    {
+        for (std::size_t i = 0; i < buffers; ++i) {
+            free_.push({ std::vector<char>(capacity), 0 });
+        }
+        writer_ = std::thread { [this, fd] { write_loop(fd); } };
+    }
+    // Writer thread points to the rings
+    async_fd_sink(const async_fd_sink&) = delete;
+    async_fd_sink& operator=(const async_fd_sink&) = delete;
+
+    ~async_fd_sink() override
+    {
+        JSON_TRY {
+            finish();
+        } JSON_CATCH(const parse_error&) {
+            // Destructor must not throw, call finish() explicitly to get write errors
+        }
+    }
+
+    // Flush and wait until everything is written, write error is rethrown or recorded
+    void finish()
+    {
+        if (writer_.joinable()) {
+            JSON_TRY {
+                flush();
+            } JSON_CATCH(const parse_error&) {
+                // Same error is rethrown below, writer has to be joined first
+            }
+            filled_.push({});
+            writer_.join();
+        }
+        if (writer_error_) {
+            fail();
+        }
+    }
+
+protected:
+    void write(std::string_view data) override
+    {
+        while (!data.empty()) {
+            if (failed_.load(std::memory_order_acquire)) {
+                fail();
+                return;
+            }
+            auto buffer = free_.pop();
+            buffer.size = std::min(data.size(), buffer.data.size());
+            std::memcpy(buffer.data.data(), data.data(), buffer.size);
+            data.remove_prefix(buffer.size);
+            filled_.push(std::move(buffer));
+        }
+    }
+
+private:
+    // Error of the joined or failed writer thread is thrown or recorded, later output is dropped
+    void fail()
+    {
+        if (throw_errors_) {
+            raise_write_error(writer_error_);
+        }
+        write_error_ = writer_error_;
+    }
+
+    void write_loop(int fd)
+    {
+        // Buffers are drained after an error too, so the producer never waits forever
+        for (auto buffer = filled_.pop(); !buffer.data.empty(); buffer = filled_.pop()) {
+            if (!failed_.load(std::memory_order_relaxed)) {
+                if (const int e = write_all(fd, { buffer.data.data(), buffer.size })) {
+                    writer_error_ = e;
+                    failed_.store(true, std::memory_order_release);
+                }
+            }
+            free_.push(std::move(buffer));
+        }
+    }
+
+    spsc_ring<io_buffer> free_;
+    spsc_ring<io_buffer> filled_;
+    // errno of the writer thread, published by failed_
+    int writer_error_ = 0;
+    std::atomic<bool> failed_ { false };
+    bool throw_errors_;
+    std::thread writer_;
+};
+
+// Vectorized input classification, simdjson-style.
+// Block of 64 bytes is classified into bitmasks where bit i describes byte i,
+// so scanning loops can jump straight to the next interesting byte.
+namespace simd {
+
+inline constexpr std::size_t block_size = 64;
+
+struct block_masks {
+    uint64_t string_special; // quote, backslash and control characters below 0x20
+    uint64_t whitespace;
+    uint64_t structural; // {}[],:
+};
+
+[[nodiscard]] inline bool is_whitespace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+[[nodiscard]] inline block_masks classify_scalar(const char* block)
+{
+    block_masks masks {};
+    for (std::size_t i = 0; i < block_size; ++i) {
+        const uint64_t bit = uint64_t { 1 } << i;
+        if (static_cast<unsigned char>(block[i]) < 0x20) {
+            masks.string_special |= bit;
+        }
+        switch (block[i]) {
+        case '"':
+        case '\\':
+            masks.string_special |= bit;
+            break;
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+            masks.whitespace |= bit;
+            break;
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ',':
+        case ':':
+            masks.structural |= bit;
+            break;
+        default:
+            break;
+        }
+    }
+    return masks;
+}
+
+// Whitespace is matched by a single table lookup: byte is whitespace if table[byte & 0xF] == byte.
+// Brackets are matched case-insensitively: '[' | 0x20 == '{' and ']' | 0x20 == '}'.
+#if defined(__x86_64__) || defined(__i386__)
+[[gnu::target("sse4.2")]] [[nodiscard]] inline block_masks classify_sse42(const char* block)
+{
+    const __m128i whitespace_table = _mm_setr_epi8(' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', 0, 0, '\r', 0, 0);
+    block_masks masks {};
+    for (std::size_t i = 0; i < block_size; i += 16) {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        const __m128i lower = _mm_or_si128(in, _mm_set1_epi8(0x20));
+        const __m128i structural = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8(',')), _mm_cmpeq_epi8(in, _mm_set1_epi8(':'))),
+            _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))));
+        const __m128i string_special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('"')), _mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))),
+            _mm_cmpeq_epi8(_mm_min_epu8(in, _mm_set1_epi8(0x1F)), in));
+        masks.string_special |= uint64_t { static_cast<uint16_t>(_mm_movemask_epi8(string_special)) } << i;
+        masks.whitespace |= uint64_t { static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_shuffle_epi8(whitespace_table, in), in))) } << i;
+        masks.structural |= uint64_t { static_cast<uint16_t>(_mm_movemask_epi8(structural)) } << i;
+    }
+    return masks;
+}
+
+[[gnu::target("avx2")]] [[nodiscard]] inline block_masks classify_avx2(const char* block)
+{
+    // vpshufb looks up each 128-bit lane separately, so the table is repeated
+    const __m256i whitespace_table = _mm256_setr_epi8(
+        ' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', 0, 0, '\r', 0, 0,
+        ' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', 0, 0, '\r', 0, 0);
+    block_masks masks {};
+    for (std::size_t i = 0; i < block_size; i += 32) {
+        const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        const __m256i lower = _mm256_or_si256(in, _mm256_set1_epi8(0x20));
+        const __m256i structural = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8(',')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8(':'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))));
+        const __m256i string_special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\'))),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(in, _mm256_set1_epi8(0x1F)), in));
+        masks.string_special |= uint64_t { static_cast<uint32_t>(_mm256_movemask_epi8(string_special)) } << i;
+        masks.whitespace |= uint64_t { static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_shuffle_epi8(whitespace_table, in), in))) } << i;
+        masks.structural |= uint64_t { static_cast<uint32_t>(_mm256_movemask_epi8(structural)) } << i;
+    }
+    return masks;
+}
+#elif defined(__aarch64__)
+// Packs four 16-byte comparison results into a 64-bit mask
+[[nodiscard]] inline uint64_t to_bitmask(uint8x16_t m0, uint8x16_t m1, uint8x16_t m2, uint8x16_t m3)
+{
+    const uint8x16_t bits = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+    uint8x16_t sum = vpaddq_u8(vpaddq_u8(vandq_u8(m0, bits), vandq_u8(m1, bits)), vpaddq_u8(vandq_u8(m2, bits), vandq_u8(m3, bits)));
+    sum = vpaddq_u8(sum, sum);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+}
+
+[[nodiscard]] inline block_masks classify_neon(const char* block)
+{
+    const uint8x16_t whitespace_table = { ' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', 0, 0, '\r', 0, 0 };
+    uint8x16_t string_special[4], whitespace[4], structural[4];
+    for (std::size_t i = 0; i < 4; ++i) {
+        const uint8x16_t in = vld1q_u8(reinterpret_cast<const uint8_t*>(block + i * 16));
+        const uint8x16_t lower = vorrq_u8(in, vdupq_n_u8(0x20));
+        string_special[i] = vorrq_u8(vorrq_u8(vceqq_u8(in, vdupq_n_u8('"')), vceqq_u8(in, vdupq_n_u8('\\'))), vcltq_u8(in, vdupq_n_u8(0x20)));
+        // Unlike pshufb, vqtbl1q_u8 does not mask the index, so take the low nibble explicitly
+        whitespace[i] = vceqq_u8(vqtbl1q_u8(whitespace_table, vandq_u8(in, vdupq_n_u8(0x0F))), in);
+        structural[i] = vorrq_u8(vorrq_u8(vceqq_u8(in, vdupq_n_u8(',')), vceqq_u8(in, vdupq_n_u8(':'))),
+            vorrq_u8(vceqq_u8(lower, vdupq_n_u8('{')), vceqq_u8(lower, vdupq_n_u8('}'))));
+    }
+    return {
+        to_bitmask(string_special[0], string_special[1], string_special[2], string_special[3]),
+        to_bitmask(whitespace[0], whitespace[1], whitespace[2], whitespace[3]),
+        to_bitmask(structural[0], structural[1], structural[2], structural[3]),
+    };
+}
+#endif
+
+using classify_fn = block_masks (*)(const char* block);
+
+[[nodiscard]] inline classify_fn select_classifier()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return classify_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return classify_sse42;
+    }
+#elif defined(__aarch64__)
+    return classify_neon;
+#endif
+    return classify_scalar;
+}
+
+// Classifier implementation is chosen once at startup according to CPU features
+inline const classify_fn classify = select_classifier();
+
+// Classify up to block_size bytes. Shorter input is copied into a zero-padded block,
+// zero byte is only a special string character, callers looking for those mask out the padding.
+[[nodiscard]] inline block_masks classify_partial(const char* begin, std::size_t size)
+{
+    if (size >= block_size) {
+        return classify(begin);
+    }
+    char tail[block_size] = {};
+    std::memcpy(tail, begin, size);
+    return classify(tail);
+}
+
+// Find first byte in [begin, end) selected by bitmask returned from select(block_masks)
+template <typename Select>
+[[nodiscard]] const char* find_first(const char* begin, const char* end, Select select)
+{
+    while (begin != end) {
+        const auto size = std::min(static_cast<std::size_t>(end - begin), block_size);
+        uint64_t mask = select(classify_partial(begin, size));
+        if (size < block_size) {
+            mask &= (uint64_t { 1 } << size) - 1;
+        }
+        if (mask) {
+            return begin + std::countr_zero(mask);
+        }
+        begin += size;
+    }
+    return end;
+}
+
+[[nodiscard]] inline const char* skip_whitespace(const char* begin, const char* end)
+{
+    // Most tokens are not preceded by whitespace at all
+    if (begin != end && !is_whitespace(*begin)) {
+        return begin;
+    }
+    return find_first(begin, end, [](const block_masks& masks) { return ~masks.whitespace; });
+}
+
+// String ends at quote, backslash starts an escape sequence, control character is an error
+[[nodiscard]] inline const char* find_string_special(const char* begin, const char* end)
+{
+    return find_first(begin, end, [](const block_masks& masks) { return masks.string_special; });
+}
+
+// Quote, backslash and control characters can't appear in JSON string as is
+[[nodiscard]] inline bool needs_escape(char c)
+{
+    return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+}
+
+[[nodiscard]] inline const char* find_escape_scalar(const char* begin, const char* end)
+{
+    return std::find_if(begin, end, needs_escape);
+}
+
+// Output strings are mostly clean, so they are scanned by whole registers instead of 64-byte blocks.
+// Control character is matched as unsigned min(byte, 0x1F) == byte.
+#if defined(__x86_64__) || defined(__i386__)
+[[gnu::target("sse4.2")]] [[nodiscard]] inline const char* find_escape_sse42(const char* begin, const char* end)
+{
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('"')), _mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))),
+            _mm_cmpeq_epi8(_mm_min_epu8(in, _mm_set1_epi8(0x1F)), in));
+        if (const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(special))) {
+            return begin + std::countr_zero(mask);
+        }
+    }
+    return find_escape_scalar(begin, end);
+}
+
+[[gnu::target("avx2")]] [[nodiscard]] inline const char* find_escape_avx2(const char* begin, const char* end)
+{
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\'))),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(in, _mm256_set1_epi8(0x1F)), in));
+        if (const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(special))) {
+            return begin + std::countr_zero(mask);
+        }
+    }
+    return find_escape_sse42(begin, end);
+}
+#elif defined(__aarch64__)
+[[nodiscard]] inline const char* find_escape_neon(const char* begin, const char* end)
+{
+    for (; end - begin >= 16; begin += 16) {
+        const uint8x16_t in = vld1q_u8(reinterpret_cast<const uint8_t*>(begin));
+        const uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(in, vdupq_n_u8('"')), vceqq_u8(in, vdupq_n_u8('\\'))),
+            vcleq_u8(in, vdupq_n_u8(0x1F)));
+        if (vmaxvq_u8(special) != 0) {
+            return find_escape_scalar(begin, begin + 16);
+        }
+    }
+    return find_escape_scalar(begin, end);
+}
+#endif
+
+using find_escape_fn = const char* (*)(const char* begin, const char* end);
+
+[[nodiscard]] inline find_escape_fn select_escape_finder()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return find_escape_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return find_escape_sse42;
+    }
+#elif defined(__aarch64__)
+    return find_escape_neon;
+#endif
+    return find_escape_scalar;
+}
+
+// Find first byte needing escape in output string
+inline const find_escape_fn find_escape = select_escape_finder();
+
+} // namespace simd
+
+// Escape sequence of a byte for which simd::needs_escape() is true
+[[nodiscard]] inline std::string_view escape_sequence(char c, std::array<char, 6>& buffer)
+{
+    switch (c) {
+    case '"':
+        return "\\\"";
+    case '\\':
+        return "\\\\";
+    case '\b':
+        return "\\b";
+    case '\f':
+        return "\\f";
+    case '\n':
+        return "\\n";
+    case '\r':
+        return "\\r";
+    case '\t':
+        return "\\t";
+    default:
+        constexpr char hex[] = "0123456789abcdef";
+        buffer = { '\\', 'u', '0', '0', hex[(c >> 4) & 0xF], hex[c & 0xF] };
+        return { buffer.data(), buffer.size() };
+    }
+}
+
+// Quoted string, clean runs between escaped bytes are appended as a whole
+inline void append_quoted(sink& out, std::string_view str)
+{
+    std::array<char, 6> buffer;
+    out.append('"');
+    for (;;) {
+        const char* special = simd::find_escape(str.data(), str.data() + str.size());
+        const auto clean = static_cast<std::size_t>(special - str.data());
+        out.append(str.substr(0, clean));
+        if (clean == str.size()) {
+            break;
+        }
+        out.append(escape_sequence(*special, buffer));
+        str.remove_prefix(clean + 1);
+    }
+    out.append('"');
+}
+
+struct parser_options {
+    // Destroyed stream skips its unconsumed remainder,
+    // so the parent stream can continue after a partially consumed value
+    bool drain_unconsumed = true;
+    // Parsing errors are thrown, or recorded as lexer::last_error() ending the input when false.
+    // Without exceptions a thrown error aborts, see raise()
+    bool throw_errors = true;
+};
+
+#ifndef JSON_STATS
+#define JSON_STATS 0
+#endif
+
+// Hot path counters are compiled in with -DJSON_STATS=1, otherwise every counting site is discarded
+inline constexpr bool stats_enabled = JSON_STATS != 0;
+
+struct stats {
+    // Consumed tokens indexed by lexer::token_type, skipped values are not tokenized
+    std::array<std::size_t, 9> tokens {};
+    std::size_t bytes = 0;
+    std::size_t strings = 0;
+    std::size_t numbers = 0;
+    std::size_t pairs = 0;
+    std::size_t elements = 0;
+    std::size_t max_depth = 0;
+    // Lexer buffer growth and string values exceeding small string buffer
+    std::size_t allocations = 0;
+    // Serialization time excludes lexing of the values being serialized
+    std::size_t lexing_ns = 0;
+    std::size_t serialization_ns = 0;
+
+    stats& operator+=(const stats& other)
+    {
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            tokens[i] += other.tokens[i];
+        }
+        bytes += other.bytes;
+        strings += other.strings;
+        numbers += other.numbers;
+        pairs += other.pairs;
+        elements += other.elements;
+        max_depth = std::max(max_depth, other.max_depth);
+        allocations += other.allocations;
+        lexing_ns += other.lexing_ns;
+        serialization_ns += other.serialization_ns;
+        return *this;
+    }
+};
+
+inline std::mutex stats_mutex;
+inline stats finished_threads_stats;
+
+// Counters of the calling thread, merged into totals when the thread exits
+[[nodiscard]] inline stats& local_stats()
+{
+    struct thread_stats {
+        stats counters;
+        ~thread_stats()
+        {
+            const std::lock_guard lock { stats_mutex };
+            finished_threads_stats += counters;
+        }
+    };
+    thread_local thread_stats instance;
+    return instance.counters;
+}
+
+// Counters of finished threads and of the calling one
+[[nodiscard]] inline stats total_stats()
+{
+    const std::lock_guard lock { stats_mutex };
+    stats total = finished_threads_stats;
+    return total += local_stats();
+}
+
+// Accumulates time of the outermost timed call, nested calls are already covered by it
+template <bool Enabled>
+class lexing_timer {
+public:
+    explicit lexing_timer(bool&) noexcept { }
+};
+
+template <>
+class lexing_timer<true> {
+public:
+    explicit lexing_timer(bool& running)
+        : running_ { running }
+        , outermost_ { !std::exchange(running, true) }
+        , start_ { outermost_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point {} }
+    {
+    }
+    lexing_timer(const lexing_timer&) = delete;
+    lexing_timer& operator=(const lexing_timer&) = delete;
+    ~lexing_timer()
+    {
+        if (outermost_) {
+            local_stats().lexing_ns += static_cast<std::size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+            running_ = false;
+        }
+    }
+
+private:
+    bool& running_;
+    bool outermost_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// FNV-1a hash of raw bytes, finds interned keys in key_pool and bound fields in key_table
+[[nodiscard]] constexpr uint32_t fnv1a(std::string_view bytes, uint32_t basis = 2166136261u)
+{
+    for (const char c : bytes) {
+        basis = (basis ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return basis;
+}
+
+// Object keys interned by the parser context, see object_stream::next_interned_key().
+// Every distinct key is copied once into an arena and gets the next sequential id,
+// so consumers compare keys by id or view pointer and repeated keys allocate nothing.
+// Open addressing table with linear probing is kept at most half full.
+// Documents with ever new keys would grow the pool without bound, so it holds at most
+// max_keys keys of max_bytes in total. Keys seen before are still found once it is full,
+// new ones are passed through uninterned.
+class key_pool {
+public:
+    struct key {
+        std::string_view text;
+        uint32_t id;
+    };
+
+    // Id of a key not interned because the pool is full, its text is the view passed to intern()
+    static constexpr uint32_t uninterned = std::numeric_limits<uint32_t>::max();
+    static constexpr std::size_t default_max_keys = std::size_t { 1 } << 20;
+    static constexpr std::size_t default_max_bytes = std::size_t { 64 } << 20;
+
+    // Ids stay below `uninterned` whatever the limit
+    explicit key_pool(std::size_t max_keys = default_max_keys, std::size_t max_bytes = default_max_bytes)
+        : max_keys_ { std::min<std::size_t>(max_keys, uninterned) }
+        , max_bytes_ { max_bytes }
+    {
+    }
+    // Interned views point into the arena
+    key_pool(const key_pool&) = delete;
+    key_pool& operator=(const key_pool&) = delete;
+
+    // Key seen before is found by its hash and bytes, new one is copied while the pool has room
+    [[nodiscard]] key intern(std::string_view text)
+    {
+        const bool full = keys_.size() == max_keys_ || text.size() > max_bytes_ - bytes_;
+        if (!full && 2 * (keys_.size() + 1) > slots_.size()) {
+            grow();
+        }
+        if (slots_.empty()) {
+            return { text, uninterned };
+        }
+        const auto hash = fnv1a(text);
+        const auto mask = slots_.size() - 1;
+        for (auto i = hash & mask;; i = (i + 1) & mask) {
+            auto& entry = slots_[i];
+            if (entry.id == empty) {
+                if (full) {
+                    return { text, uninterned };
+                }
+                entry = { hash, static_cast<uint32_t>(keys_.size()) };
+                keys_.push_back(copy(text));
+                bytes_ += text.size();
+                return { keys_.back(), entry.id };
+            }
+            if (entry.hash == hash && keys_[entry.id] == text) {
+                return { keys_[entry.id], entry.id };
+            }
+        }
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return keys_.size();
+    }
+
+    // Text of the key with the given id
+    [[nodiscard]] std::string_view operator[](uint32_t id) const
+    {
+        return keys_[id];
+    }
+
+private:
+    static constexpr uint32_t empty = std::numeric_limits<uint32_t>::max();
+
+    struct slot {
+        uint32_t hash = 0;
+        uint32_t id = empty;
+    };
+
+    void grow()
+    {
+        std::vector<slot> slots(std::max<std::size_t>(2 * slots_.size(), 64));
+        const auto mask = slots.size() - 1;
+        for (const auto& entry : slots_) {
+            if (entry.id != empty) {
+                auto i = entry.hash & mask;
+                while (slots[i].id != empty) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = entry;
+            }
+        }
+        slots_ = std::move(slots);
+    }
+
+    [[nodiscard]] std::string_view copy(std::string_view text)
+    {
+        auto* data = static_cast<char*>(arena_.allocate(text.size() + 1, 1));
+        std::memcpy(data, text.data(), text.size());
+        return { data, text.size() };
+    }
+
+    std::vector<slot> slots_;
+    std::vector<std::string_view> keys_;
+    std::pmr::monotonic_buffer_resource arena_;
+    std::size_t max_keys_;
+    std::size_t max_bytes_;
+    // Bytes of interned keys, counted against max_bytes_
+    std::size_t bytes_ = 0;
+};
+
+// Lexer outputs a sequence of tokens - language's basic primitives, without verifying any grammatics.
+class lexer {
+public:
+    enum class token_type {
+        STRING,
+        NUMBER,
+        OBJECT_BEGIN, // {
+        OBJECT_END, // }
+        ARRAY_BEGIN, // [
+        ARRAY_END, // ]
+        COMMA, // ,
+        COLON, // :
+        END_OF_INPUT,
+    };
+    static_assert(static_cast<std::size_t>(token_type::END_OF_INPUT) + 1 == std::tuple_size_v<decltype(stats::tokens)>);
+
+    // Numbers keep integer precision whenever the value fits int64_t.
+    // Punctuation tokens carry no value, so they are consumed by type alone.
+    using number = std::variant<int64_t, double>;
+
+    explicit lexer(std::unique_ptr<source> src, parser_options options = {})
+        : source_ { std::move(src) }
+        , options_ { options }
+    {
+    }
+
+    // Streams point to the lexer, so it must stay in place
+    lexer(const lexer&) = delete;
+    lexer& operator=(const lexer&) = delete;
+#ifndef NDEBUG
+    ~lexer()
+    {
+        assert(borrowers_ == 0 && "Stream outlived its parser");
+    }
+#endif
+
+    // Get current token type without consuming it
+    [[nodiscard]] token_type peek_type()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        // Skip whitespace characters
+        do {
+            pos_ = simd::skip_whitespace(pos_, end_);
+        } while (pos_ == end_ && refill());
+
+        if (pos_ == end_) {
+            return token_type::END_OF_INPUT;
+        }
+        return classify(*pos_, failure { this });
+    }
+
+    // Consume punctuation token only if it is of expected type
+    [[nodiscard]] bool try_consume_token(token_type type)
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        assert(type != token_type::STRING && type != token_type::NUMBER && "Values are consumed with next_string() or next_number()");
+        if (peek_type() != type) {
+            return false;
+        }
+        consume_token(type);
+        return true;
+    }
+
+    // Consume punctuation token after peek_type() reported it
+    void consume_token(token_type type)
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        assert(type != token_type::STRING && type != token_type::NUMBER && "Values are consumed with next_string() or next_number()");
+        switch (type) {
+        case token_type::OBJECT_BEGIN:
+        case token_type::ARRAY_BEGIN:
+            ++depth_;
+            break;
+        case token_type::OBJECT_END:
+        case token_type::ARRAY_END:
+            --depth_;
+            break;
+        default:
+            break;
+        }
+        if (type != token_type::END_OF_INPUT) {
+            ++pos_;
+        }
+        if constexpr (stats_enabled) {
+            auto& counters = local_stats();
+            ++counters.tokens[static_cast<std::size_t>(type)];
+            counters.max_depth = std::max(counters.max_depth, depth_);
+        }
+    }
+
+    // Consume string token only if it is next, used for object keys
+    [[nodiscard]] std::optional<std::string_view> try_consume_string()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        if (peek_type() != token_type::STRING) {
+            return std::nullopt;
+        }
+        return parse_string();
+    }
+
+    // Consume value token after peek_type() reported it.
+    // String view is valid until the next token is requested.
+    [[nodiscard]] std::string_view next_string()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        assert(pos_ != end_ && *pos_ == '"');
+        return parse_string();
+    }
+
+    [[nodiscard]] number next_number()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        assert(pos_ != end_ && *pos_ != '"');
+        return parse_number();
+    }
+
+    // Value tokens with the error by value when errors are not thrown, as parser::try_parse() returns it
+    [[nodiscard]] std::expected<std::string_view, error> try_next_string()
+    {
+        const auto str = next_string();
+        if (error_) {
+            return std::unexpected(*error_);
+        }
+        return str;
+    }
+
+    [[nodiscard]] std::expected<number, error> try_next_number()
+    {
+        const auto num = next_number();
+        if (error_) {
+            return std::unexpected(*error_);
+        }
+        return num;
+    }
+
+    // Consume value token after peek_type() reported it, checking it without decoding or converting
+    void check_string()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        assert(pos_ != end_ && *pos_ == '"');
+        count_value(token_type::STRING);
+        ++pos_; // Skip opening quote
+        for (;;) {
+            const auto* special = simd::find_string_special(pos_, end_);
+            if (special == end_) {
+                if (!refill()) {
+                    fail(error_code::UNTERMINATED_STRING);
+                    return;
+                }
+                continue;
+            }
+            pos_ = special + 1;
+            if (*special == '"') {
+                return;
+            }
+            if (*special != '\\') {
+                pos_ = special;
+                fail(error_code::UNESCAPED_CONTROL_CHARACTER);
+                return;
+            }
+            char decoded[4];
+            (void)decode_escape([this] { return next_string_char(); }, decoded, failure { this });
+        }
+    }
+
+    void check_number()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        assert(pos_ != end_ && *pos_ != '"');
+        (void)parse_number<false>();
+    }
+
+    // Consume value token after peek_type() reported it, checking it without decoding or converting.
+    // View of its source bytes, quotes and escapes included, is valid until the next token is requested.
+    [[nodiscard]] std::string_view next_raw_string()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        assert(pos_ != end_ && *pos_ == '"');
+        count_value(token_type::STRING);
+        // Token is viewed in place until it crosses chunk boundary, then it is collected in owning buffer
+        const char* first = pos_++;
+        bool collected = false;
+        const auto refill_raw = [&] {
+            if (!std::exchange(collected, true)) {
+                buffer_.clear();
+            }
+            buffer_append(first, end_);
+            const bool refilled = refill();
+            first = pos_;
+            return refilled;
+        };
+        for (;;) {
+            const auto* special = simd::find_string_special(pos_, end_);
+            pos_ = special;
+            if (special == end_) {
+                if (!refill_raw()) {
+                    // Placeholder for the missing value once the error is recorded
+                    fail(error_code::UNTERMINATED_STRING);
+                    return "\"\"";
+                }
+                continue;
+            }
+            if (*special != '"' && *special != '\\') {
+                fail(error_code::UNESCAPED_CONTROL_CHARACTER);
+                return "\"\"";
+            }
+            ++pos_;
+            if (*special == '"') {
+                break;
+            }
+            char decoded[4];
+            (void)decode_escape([&] {
+                if (pos_ == end_ && !refill_raw()) {
+                    fail(error_code::UNTERMINATED_STRING);
+                    return '"';
+                }
+                return *pos_++;
+            },
+                decoded, failure { this });
+        }
+        if (!collected) {
+            return { first, static_cast<std::size_t>(pos_ - first) };
+        }
+        buffer_append(first, pos_);
+        return buffer_;
+    }
+
+    [[nodiscard]] std::string_view next_raw_number()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        assert(pos_ != end_ && *pos_ != '"');
+        count_value(token_type::NUMBER);
+        const auto text = number_text();
+        (void)convert_number<false>(text.data(), text.data() + text.size(), failure { this });
+        return error_ ? "0" : text;
+    }
+
+    [[nodiscard]] const parser_options& options() const noexcept
+    {
+        return options_;
+    }
+
+    // Keys interned by the streams of this lexer, valid as long as the lexer
+    [[nodiscard]] key_pool& keys() noexcept
+    {
+        return keys_;
+    }
+
+    // First parsing error, recorded only when errors are not thrown
+    [[nodiscard]] const std::optional<error>& last_error() const noexcept
+    {
+        return error_;
+    }
+
+    // Report parsing error at the current position, grammar errors of the streams included.
+    // Recorded error ends the input: callers return a placeholder value and parsing unwinds normally.
+    [[gnu::cold]] void fail(error_code code, char character = 0, int system_error = 0)
+    {
+        const error e { code, current_position().offset, character, system_error };
+        if (options_.throw_errors) {
+            raise(parse_error { e });
+        }
+        if (!error_) {
+            error_ = e;
+        }
+        pos_ = end_;
+    }
+
+    // Nesting depth of containers opened by consumed tokens
+    [[nodiscard]] std::size_t depth() const noexcept
+    {
+        return depth_;
+    }
+
+    // Byte offset and line number in the input
+    struct position {
+        std::size_t offset = 0;
+        std::size_t line = 0;
+    };
+
+    // Lines are counted only on request, before any input is consumed
+    void track_lines() noexcept
+    {
+        assert(chunk_offset_ == 0 && pos_ == chunk_begin_);
+        track_lines_ = true;
+    }
+
+    // Position of the next unconsumed byte, line is zero unless tracked
+    [[nodiscard]] position current_position() noexcept
+    {
+        if (track_lines_) {
+            line_ += static_cast<std::size_t>(std::count(lines_counted_, pos_, '\n'));
+            lines_counted_ = pos_;
+        }
+        return { chunk_offset_ + static_cast<std::size_t>(pos_ - chunk_begin_), track_lines_ ? line_ : 0 };
+    }
+
+    // Skip next value without building tokens
+    void skip_value()
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        switch (peek_type()) {
+        case token_type::STRING:
+            ++pos_; // Skip opening quote
+            skip_raw(0, true);
+            break;
+        case token_type::NUMBER:
+            do {
+                pos_ = std::find_if_not(pos_, end_, is_number_char);
+            } while (pos_ == end_ && refill());
+            break;
+        case token_type::OBJECT_BEGIN:
+        case token_type::ARRAY_BEGIN:
+            ++pos_; // Skip opening bracket
+            skip_raw(1, false);
+            break;
+        default:
+            fail(error_code::EXPECTED_VALUE);
+        }
+    }
+
+    // Skip input until containers nesting depth drops to the given level
+    void skip_to_depth(std::size_t depth)
+    {
+        [[maybe_unused]] const lexing_timer<stats_enabled> timer { timing_ };
+        if (depth_ > depth) {
+            skip_raw(depth_ - depth, false);
+            depth_ = depth;
+        }
+    }
+
+private:
+    // Error callback of the decoding helpers shared with push_parser
+    struct failure {
+        lexer* owner;
+
+        void operator()(error_code code, char character = 0) const
+        {
+            owner->fail(code, character);
+        }
+    };
+
+    // Token type starting with the given non-whitespace byte, end of input after a recorded error
+    template <typename Fail>
+    [[nodiscard]] static token_type classify(char c, Fail&& fail)
+    {
+        switch (c) {
+        case '{':
+            return token_type::OBJECT_BEGIN;
+        case '}':
+            return token_type::OBJECT_END;
+        case '[':
+            return token_type::ARRAY_BEGIN;
+        case ']':
+            return token_type::ARRAY_END;
+        case ',':
+            return token_type::COMMA;
+        case ':':
+            return token_type::COLON;
+        case '"':
+            return token_type::STRING;
+        default:
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '-') {
+                return token_type::NUMBER;
+            }
+            fail(error_code::UNEXPECTED_CHARACTER, c);
+            return token_type::END_OF_INPUT;
+        }
+    }
+
+    // Replace exhausted chunk with the next one from source.
+    // Returns false at end of input.
+    bool refill()
+    {
+        if (error_) {
+            return false;
+        }
+        if (track_lines_) {
+            line_ += static_cast<std::size_t>(std::count(lines_counted_, end_, '\n'));
+        }
+        chunk_offset_ += static_cast<std::size_t>(end_ - chunk_begin_);
+        auto chunk = source_->next_chunk();
+        if constexpr (stats_enabled) {
+            local_stats().bytes += chunk.size();
+        }
+        chunk_begin_ = lines_counted_ = pos_ = chunk.data();
+        end_ = chunk.data() + chunk.size();
+        if (chunk.empty() && source_->read_error() != 0) {
+            fail(error_code::READ_ERROR, 0, source_->read_error());
+        }
+        return !chunk.empty();
+    }
+
+    // Scan raw bytes until `depth` open containers are closed, or until the string is closed for zero depth.
+    // Only quotes, backslashes and brackets are looked at, so skipped input is not validated,
+    // other control characters among the candidates are passed over.
+    void skip_raw(std::size_t depth, bool in_string)
+    {
+        bool escaped = false; // backslash was the last byte of previous block
+        do {
+            while (pos_ != end_) {
+                const auto size = std::min(static_cast<std::size_t>(end_ - pos_), simd::block_size);
+                const auto masks = simd::classify_partial(pos_, size);
+                uint64_t candidates = (masks.string_special & ~masks.whitespace) | masks.structural;
+                if (size < simd::block_size) {
+                    candidates &= (uint64_t { 1 } << size) - 1;
+                }
+                if (std::exchange(escaped, false)) {
+                    candidates &= ~uint64_t { 1 };
+                }
+                while (candidates) {
+                    const auto i = static_cast<std::size_t>(std::countr_zero(candidates));
+                    candidates &= candidates - 1;
+                    const char c = pos_[i];
+                    if (in_string) {
+                        if (c == '\\') {
+                            // Escaped character never terminates the string
+                            if (i + 1 == size) {
+                                escaped = true;
+                            } else {
+                                candidates &= ~(uint64_t { 2 } << i);
+                            }
+                        } else if (c == '"') {
+                            in_string = false;
+                        }
+                    } else if (c == '"') {
+                        in_string = true;
+                    } else if (c == '{' || c == '[') {
+                        ++depth;
+                    } else if (c == '}' || c == ']') {
+                        --depth;
+                    }
+                    if (!in_string && depth == 0) {
+                        pos_ += i + 1;
+                        return;
+                    }
+                }
+                pos_ += size;
+            }
+        } while (refill());
+        fail(in_string ? error_code::UNTERMINATED_STRING : error_code::UNEXPECTED_END_OF_INPUT);
+    }
+
+    void count_value(token_type type)
+    {
+        if constexpr (stats_enabled) {
+            auto& counters = local_stats();
+            ++counters.tokens[static_cast<std::size_t>(type)];
+            ++(type == token_type::STRING ? counters.strings : counters.numbers);
+        }
+    }
+
+    // Appends to owning buffer, counting its reallocations
+    void buffer_append(const char* first, const char* last)
+    {
+        [[maybe_unused]] const auto capacity = buffer_.capacity();
+        buffer_.append(first, last);
+        if constexpr (stats_enabled) {
+            local_stats().allocations += buffer_.capacity() != capacity;
+        }
+    }
+
+    [[nodiscard]] std::string_view parse_string()
+    {
+        count_value(token_type::STRING);
+        ++pos_; // Skip opening quote
+
+        // Fast path: string without escapes is in the current chunk and is returned in place
+        const auto* special = simd::find_string_special(pos_, end_);
+        if (special != end_ && *special == '"') {
+            std::string_view result { pos_, static_cast<std::size_t>(special - pos_) };
+            pos_ = special + 1; // Skip closing quote
+            return result;
+        }
+
+        // String crosses chunk boundary or has escapes, collect it decoded in owning buffer
+        buffer_.clear();
+        for (;;) {
+            buffer_append(pos_, special);
+            pos_ = special;
+            if (pos_ == end_) {
+                if (!refill()) {
+                    // Empty placeholder for the missing value once the error is recorded, never a null view
+                    fail(error_code::UNTERMINATED_STRING);
+                    return "";
+                }
+            } else if (*pos_ == '"') {
+                ++pos_;
+                return std::string_view { buffer_ };
+            } else if (*pos_ == '\\') {
+                ++pos_;
+                unescape();
+            } else {
+                fail(error_code::UNESCAPED_CONTROL_CHARACTER);
+                return "";
+            }
+            special = simd::find_string_special(pos_, end_);
+        }
+    }
+
+    // Next byte of the string, escape sequence may cross chunk boundary.
+    // Missing byte reads as closing quote once the error is recorded.
+    [[nodiscard]] char next_string_char()
+    {
+        if (pos_ == end_ && !refill()) {
+            fail(error_code::UNTERMINATED_STRING);
+            return '"';
+        }
+        return *pos_++;
+    }
+
+    // Decode escape sequence following backslash into owning buffer
+    void unescape()
+    {
+        char decoded[4];
+        const auto size = decode_escape([this] { return next_string_char(); }, decoded, failure { this });
+        buffer_append(decoded, decoded + size);
+    }
+
+    template <typename Next, typename Fail>
+    [[nodiscard]] static uint32_t parse_hex4(Next& next, Fail& fail)
+    {
+        uint32_t code = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char c = next();
+            if (is_digit(c)) {
+                code = code << 4 | static_cast<uint32_t>(c - '0');
+            } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+                code = code << 4 | static_cast<uint32_t>((c | 0x20) - 'a' + 10);
+            } else {
+                fail(error_code::INVALID_UNICODE_ESCAPE);
+                return 0;
+            }
+        }
+        return code;
+    }
+
+    // Decode escape sequence following backslash, next() supplies the bytes after it.
+    // Characters out of Basic Multilingual Plane are escaped as UTF-16 surrogate pairs.
+    // Returns number of bytes written, none after a recorded error.
+    template <typename Next, typename Fail>
+    [[nodiscard]] static std::size_t decode_escape(Next&& next, char* out, Fail&& fail)
+    {
+        switch (const char c = next()) {
+        case '"':
+        case '\\':
+        case '/':
+            out[0] = c;
+            return 1;
+        case 'b':
+            out[0] = '\b';
+            return 1;
+        case 'f':
+            out[0] = '\f';
+            return 1;
+        case 'n':
+            out[0] = '\n';
+            return 1;
+        case 'r':
+            out[0] = '\r';
+            return 1;
+        case 't':
+            out[0] = '\t';
+            return 1;
+        case 'u': {
+            uint32_t code = parse_hex4(next, fail);
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                if (next() != '\\' || next() != 'u') {
+                    fail(error_code::UNPAIRED_SURROGATE);
+                    return 0;
+                }
+                const uint32_t low = parse_hex4(next, fail);
+                if (low < 0xDC00 || low > 0xDFFF) {
+                    fail(error_code::UNPAIRED_SURROGATE);
+                    return 0;
+                }
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                fail(error_code::UNPAIRED_SURROGATE);
+                return 0;
+            }
+            return encode_utf8(code, out);
+        }
+        default:
+            fail(error_code::INVALID_ESCAPE, c);
+            return 0;
+        }
+    }
+
+    // Returns number of bytes written
+    static std::size_t encode_utf8(uint32_t code, char* out)
+    {
+        if (code < 0x80) {
+            out[0] = static_cast<char>(code);
+            return 1;
+        }
+        if (code < 0x800) {
+            out[0] = static_cast<char>(0xC0 | code >> 6);
+            out[1] = static_cast<char>(0x80 | (code & 0x3F));
+            return 2;
+        }
+        if (code < 0x10000) {
+            out[0] = static_cast<char>(0xE0 | code >> 12);
+            out[1] = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+            out[2] = static_cast<char>(0x80 | (code & 0x3F));
+            return 3;
+        }
+        out[0] = static_cast<char>(0xF0 | code >> 18);
+        out[1] = static_cast<char>(0x80 | (code >> 12 & 0x3F));
+        out[2] = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        out[3] = static_cast<char>(0x80 | (code & 0x3F));
+        return 4;
+    }
+
+    [[nodiscard]] static bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    [[nodiscard]] static bool is_number_char(char c)
+    {
+        return is_digit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+    }
+
+    template <bool Convert = true>
+    [[nodiscard]] number parse_number()
+    {
+        count_value(token_type::NUMBER);
+        const auto text = number_text();
+        return convert_number<Convert>(text.data(), text.data() + text.size(), failure { this });
+    }
+
+    // Consumes characters of number token, valid until the next token is requested
+    [[nodiscard]] std::string_view number_text()
+    {
+        // Fast path: whole number is in the current chunk and is viewed in place
+        if (const auto* last = std::find_if_not(pos_, end_, is_number_char); last != end_) {
+            const auto* first = std::exchange(pos_, last);
+            return { first, static_cast<std::size_t>(last - first) };
+        }
+
+        // Number crosses chunk boundary, collect it in owning buffer
+        buffer_.clear();
+        buffer_append(pos_, end_);
+        while (refill()) {
+            const auto* last = std::find_if_not(pos_, end_, is_number_char);
+            buffer_append(pos_, last);
+            pos_ = last;
+            if (last != end_) {
+                break;
+            }
+        }
+        return buffer_;
+    }
+
+    // Converts number of JSON grammar -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? without allocations.
+    // Integers are parsed with std::from_chars. Doubles exactly computable by Clinger's fast path
+    // (up to 2^53 mantissa scaled by exact power of ten) are computed directly,
+    // the rest is correctly rounded by std::from_chars.
+    // Without conversion only grammar and range are checked, the result is zero as after a recorded error.
+    template <bool Convert = true, typename Fail>
+    [[nodiscard]] static number convert_number(const char* begin, const char* end, Fail&& fail)
+    {
+        const char* p = begin + (*begin == '-');
+        // Significant digits, 19 of them always fit uint64_t
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool truncated = false;
+        auto consume_digits = [&](bool fraction) {
+            const char* first = p;
+            for (; p != end && is_digit(*p); ++p) {
+                if (mantissa == 0 && *p == '0') {
+                    exponent -= fraction;
+                } else if (digits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    ++digits;
+                    exponent -= fraction;
+                } else {
+                    truncated = true;
+                    exponent += !fraction;
+                }
+            }
+            return p != first;
+        };
+
+        if (p == end || !is_digit(*p)) {
+            fail(error_code::EXPECTED_DIGIT);
+            return number {};
+        }
+        if (*p == '0' && p + 1 != end && is_digit(p[1])) {
+            fail(error_code::LEADING_ZEROS);
+            return number {};
+        }
+        consume_digits(false);
+
+        bool is_integer = true;
+        if (p != end && *p == '.') {
+            ++p;
+            is_integer = false;
+            if (!consume_digits(true)) {
+                fail(error_code::EXPECTED_FRACTION_DIGIT);
+                return number {};
+            }
+        }
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            is_integer = false;
+            const bool negative_exponent = p != end && *p == '-';
+            if (p != end && (*p == '-' || *p == '+')) {
+                ++p;
+            }
+            if (p == end || !is_digit(*p)) {
+                fail(error_code::EXPECTED_EXPONENT_DIGIT);
+                return number {};
+            }
+            int value = 0;
+            for (; p != end && is_digit(*p); ++p) {
+                value = std::min(value * 10 + (*p - '0'), 100000); // far beyond double range anyway
+            }
+            exponent += negative_exponent ? -value : value;
+        }
+        if (p != end) {
+            if (*p == '.') {
+                fail(error_code::MULTIPLE_DECIMAL_POINTS);
+                return number {};
+            }
+            fail(error_code::UNEXPECTED_CHARACTER_IN_NUMBER, *p);
+            return number {};
+        }
+
+        if constexpr (Convert) {
+            // Negative zero has no int64_t representation, it is kept as double
+            if (is_integer && (mantissa != 0 || *begin != '-')) {
+                int64_t value = 0;
+                if (std::from_chars(begin, end, value).ec == std::errc {}) {
+                    return value;
+                }
+                // Integer out of int64_t range is kept as double
+            }
+        }
+        // Fast path requires double arithmetics without excess precision
+        if (FLT_EVAL_METHOD == 0 && !truncated && mantissa <= (uint64_t { 1 } << 53) && exponent >= -22 && exponent <= 22) {
+            if constexpr (!Convert) {
+                return {};
+            }
+            double value = static_cast<double>(mantissa);
+            value = exponent < 0 ? value / powers_of_ten[-exponent] : value * powers_of_ten[exponent];
+            return *begin == '-' ? -value : value;
+        }
+        double value = 0;
+        if (std::from_chars(begin, end, value).ec != std::errc {}) {
+            // Magnitude below 1 can't overflow, so the value underflows to zero as in strtod()
+            if (exponent + digits <= 0) {
+                return *begin == '-' ? -0.0 : 0.0;
+            }
+            fail(error_code::NUMBER_OUT_OF_RANGE);
+            return number {};
+        }
+        return value;
+    }
+
+    // Powers of ten exactly representable as double
+    static constexpr double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    friend class lexer_ref;
+    template <typename Handler>
+    friend class push_parser;
+
+    std::unique_ptr<source> source_;
+    parser_options options_;
+    std::size_t depth_ = 0;
+    // Unconsumed part of the current chunk
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
+    // Owning storage for string and number tokens crossing chunk boundary
+    std::string buffer_;
+    // Start of the current chunk and total size of previous chunks
+    const char* chunk_begin_ = nullptr;
+    std::size_t chunk_offset_ = 0;
+    // Newlines are counted up to `lines_counted_` only when tracked
+    const char* lines_counted_ = nullptr;
+    std::size_t line_ = 1;
+    bool track_lines_ = false;
+    std::optional<error> error_;
+    key_pool keys_;
+    // Lexing time is being measured by an outer call, see lexing_timer
+    bool timing_ = false;
+#ifndef NDEBUG
+    // Number of streams borrowing this lexer
+    std::size_t borrowers_ = 0;
+#endif
+};
+
+// Grammar of JSON containers, one state machine for every parsing mode: object_stream and array_stream
+// pull tokens from the lexer, walk_events() peeks them for SAX parsing and validation,
+// push_parser classifies them in fed fragments and keeps the state between feed() calls.
+// State is what the innermost container allows next, next() tells what the next token does there.
+// Drivers differ only in where tokens come from and where open containers are kept.
+struct grammar {
+    using token_type = lexer::token_type;
+
+    enum class state : uint8_t {
+        VALUE,
+        FIRST_ELEMENT, // value or ']'
+        FIRST_KEY, // key or '}'
+        KEY,
+        COLON,
+        SEPARATOR, // ',' or end of the innermost container
+        DONE,
+    };
+
+    enum class step : uint8_t {
+        VALUE, // token begins a value
+        KEY, // string token is a key
+        PUNCTUATION, // ',' or ':' is consumed, see after()
+        END, // token ends the innermost container
+        ERROR, // token is unexpected, see error()
+    };
+
+    // What token does in state, object tells whether the innermost container is an object
+    [[nodiscard]] static constexpr step next(state current, token_type type, bool object) noexcept
+    {
+        switch (current) {
+        case state::FIRST_ELEMENT:
+            if (type == token_type::ARRAY_END) {
+                return step::END;
+            }
+            [[fallthrough]];
+        case state::VALUE:
+            return type == token_type::STRING || type == token_type::NUMBER || type == token_type::OBJECT_BEGIN || type == token_type::ARRAY_BEGIN
+                ? step::VALUE
+                : step::ERROR;
+        case state::FIRST_KEY:
+            if (type == token_type::OBJECT_END) {
+                return step::END;
+            }
+            [[fallthrough]];
+        case state::KEY:
+            return type == token_type::STRING ? step::KEY : step::ERROR;
+        case state::COLON:
+            return type == token_type::COLON ? step::PUNCTUATION : step::ERROR;
+        case state::SEPARATOR:
+            if (type == token_type::COMMA) {
+                return step::PUNCTUATION;
+            }
+            return type == (object ? token_type::OBJECT_END : token_type::ARRAY_END) ? step::END : step::ERROR;
+        case state::DONE:
+            break;
+        }
+        return step::ERROR;
+    }
+
+    // State after key or punctuation accepted in state
+    [[nodiscard]] static constexpr state after(state current, bool object) noexcept
+    {
+        switch (current) {
+        case state::FIRST_KEY:
+        case state::KEY:
+            return state::COLON;
+        case state::COLON:
+            return state::VALUE;
+        case state::SEPARATOR:
+            return object ? state::KEY : state::VALUE;
+        default:
+            return current;
+        }
+    }
+
+    // State after value or container is complete
+    [[nodiscard]] static constexpr state after_value(bool nested) noexcept
+    {
+        return nested ? state::SEPARATOR : state::DONE;
+    }
+
+    // State at the beginning of a container
+    [[nodiscard]] static constexpr state begin(bool object) noexcept
+    {
+        return object ? state::FIRST_KEY : state::FIRST_ELEMENT;
+    }
+
+    // Error of a token next() rejects in state, end of input included
+    [[nodiscard]] static constexpr error_code error(state current, bool object) noexcept
+    {
+        switch (current) {
+        case state::FIRST_KEY:
+        case state::KEY:
+            return error_code::EXPECTED_KEY;
+        case state::COLON:
+            return error_code::EXPECTED_COLON;
+        case state::SEPARATOR:
+            return object ? error_code::EXPECTED_PAIR_SEPARATOR : error_code::EXPECTED_ELEMENT_SEPARATOR;
+        default:
+            return error_code::EXPECTED_VALUE;
+        }
+    }
+};
+
+// Push-mode parser for input arriving in fragments, e.g. network buffers.
+// Caller feeds fragments as they come and parser never waits for more input:
+// token cut by fragment edge is kept in owning buffer, grammar state and open containers
+// are explicit, so parsing resumes with the next feed() where the previous one stopped.
+// Tokens drive the same grammar as the streams and walk_events(), see grammar.
+// Async streams are built on top of these events, see async_parser.
+// Handler gets every value as soon as its token is complete:
+// on_begin_object(), on_end_object(), on_begin_array(), on_end_array(),
+// on_key(std::string_view), on_string(std::string_view), on_int(int64_t) and on_double(double).
+// String views are valid only during the call.
+// Errors are thrown, or recorded as last_error() ending the input when parser_options::throw_errors is false,
+// handler gets no more events then. Offsets count bytes of all fragments fed so far.
+template <typename Handler>
+class push_parser {
+public:
+    explicit push_parser(Handler&& handler, parser_options options = {})
+        : handler_ { std::forward<Handler>(handler) }
+        , options_ { options }
+    {
+    }
+
+    // Parse next fragment of input, only whitespace may follow the top-level value
+    void feed(std::span<const char> fragment)
+    {
+        const char* p = fragment.data();
+        const char* const end = p + fragment.size();
+        if (p == end) {
+            return;
+        }
+        fragment_ = p;
+        // Token cut by the previous fragment edge is completed first
+        if (partial_ == partial_token::STRING) {
+            p = scan_string(p, end, false);
+        } else if (partial_ == partial_token::NUMBER) {
+            p = scan_number(p, end, false);
+        }
+        while (p != end && state_ != state::DONE) {
+            p = simd::skip_whitespace(p, end);
+            if (p != end) {
+                p = parse_token(p, end);
+            }
+        }
+        // Data after the value is reported as the lexer does, also when it comes in a later fragment
+        if (state_ == state::DONE && !error_) {
+            p = simd::skip_whitespace(p, end);
+            if (p != end && lexer::classify(*p, failure { this, p }) != token_type::END_OF_INPUT) {
+                fail(error_code::UNEXPECTED_DATA_AFTER_VALUE, p);
+            }
+        }
+        fed_ += static_cast<std::size_t>(end - fragment_);
+        fragment_ = nullptr;
+    }
+
+    // End of input, number at the end of the last fragment is completed
+    void finish()
+    {
+        if (partial_ == partial_token::STRING) {
+            fail(error_code::UNTERMINATED_STRING, nullptr);
+            return;
+        }
+        if (partial_ == partial_token::NUMBER) {
+            partial_ = partial_token::NONE;
+            complete_number(buffer_.data(), buffer_.data() + buffer_.size(), nullptr);
+        }
+        if (state_ != state::DONE) {
+            fail(nullptr);
+        }
+    }
+
+    // Read error of the caller's input ends it, thrown or recorded as parsing errors are
+    void fail_read(int system_error)
+    {
+        fail(error_code::READ_ERROR, nullptr, 0, system_error);
+    }
+
+    // Top-level value is complete, or parsing ended at a recorded error
+    [[nodiscard]] bool done() const noexcept
+    {
+        return state_ == state::DONE;
+    }
+
+    // First error, when errors are recorded instead of thrown
+    [[nodiscard]] const std::optional<error>& last_error() const noexcept
+    {
+        return error_;
+    }
+
+private:
+    using token_type = lexer::token_type;
+    using state = grammar::state;
+
+    enum class partial_token : uint8_t {
+        NONE,
+        STRING,
+        NUMBER,
+    };
+
+    const char* parse_token(const char* p, const char* end)
+    {
+        const auto type = lexer::classify(*p, failure { this, p });
+        if (type == token_type::END_OF_INPUT) {
+            return end;
+        }
+        switch (grammar::next(state_, type, in_object())) {
+        case grammar::step::VALUE:
+            return begin_value(type, p, end);
+        case grammar::step::KEY:
+            key_ = true;
+            return scan_string(p + 1, end, true);
+        case grammar::step::PUNCTUATION:
+            state_ = grammar::after(state_, in_object());
+            return p + 1;
+        case grammar::step::END:
+            return close(p);
+        case grammar::step::ERROR:
+            break;
+        }
+        fail(p);
+        return end;
+    }
+
+    [[nodiscard]] bool in_object() const noexcept
+    {
+        return !containers_.empty() && containers_.back();
+    }
+
+    const char* begin_value(token_type type, const char* p, const char* end)
+    {
+        switch (type) {
+        case token_type::OBJECT_BEGIN:
+            containers_.push_back(true);
+            state_ = grammar::begin(true);
+            handler_.on_begin_object();
+            return p + 1;
+        case token_type::ARRAY_BEGIN:
+            containers_.push_back(false);
+            state_ = grammar::begin(false);
+            handler_.on_begin_array();
+            return p + 1;
+        case token_type::STRING:
+            key_ = false;
+            return scan_string(p + 1, end, true);
+        default:
+            return scan_number(p, end, true);
+        }
+    }
+
+    const char* close(const char* p)
+    {
+        const bool object = containers_.back();
+        containers_.pop_back();
+        if (object) {
+            handler_.on_end_object();
+        } else {
+            handler_.on_end_array();
+        }
+        after_value();
+        return p + 1;
+    }
+
+    void after_value()
+    {
+        state_ = grammar::after_value(!containers_.empty());
+    }
+
+    // Byte offset of a position in the current fragment, null stands for the end of the fed input
+    [[nodiscard]] std::size_t offset_of(const char* at) const noexcept
+    {
+        return fed_ + (at ? static_cast<std::size_t>(at - fragment_) : 0);
+    }
+
+    // Report parsing error at the given position, as lexer::fail() does
+    [[gnu::cold]] void fail(error_code code, const char* at, char character = 0, int system_error = 0)
+    {
+        const error e { code, offset_of(at), character, system_error };
+        if (options_.throw_errors) {
+            raise(parse_error { e });
+        }
+        if (!error_) {
+            error_ = e;
+        }
+        state_ = state::DONE;
+        partial_ = partial_token::NONE;
+    }
+
+    // Unexpected token or end of input, same errors as the pull parser reports
+    void fail(const char* at)
+    {
+        fail(grammar::error(state_, in_object()), at);
+    }
+
+    // Error callback of the lexer helpers, errors are reported at the end of the token
+    struct failure {
+        push_parser* owner;
+        const char* at;
+
+        void operator()(error_code code, char character = 0) const
+        {
+            owner->fail(code, at, character);
+        }
+    };
+
+    // Scan string body after opening quote. String without escapes within one fragment
+    // is passed in place, otherwise raw bytes are collected and decoded once the string is closed.
+    const char* scan_string(const char* p, const char* end, bool fresh)
+    {
+        const char* const begin = p;
+        if (fresh) {
+            partial_ = partial_token::STRING;
+            escapes_ = false;
+            buffer_.clear();
+        } else if (std::exchange(escaped_, false)) {
+            ++p; // Escaped byte never terminates the string
+        }
+        for (;;) {
+            p = simd::find_string_special(p, end);
+            if (p != end && *p == '"') {
+                break;
+            }
+            if (p != end && *p != '\\') {
+                fail(error_code::UNESCAPED_CONTROL_CHARACTER, p);
+                return end;
+            }
+            if (p != end) {
+                escapes_ = true;
+                ++p;
+                if (p != end) {
+                    ++p;
+                    continue;
+                }
+                escaped_ = true;
+            }
+            buffer_.append(begin, end);
+            return end;
+        }
+        partial_ = partial_token::NONE;
+        if (fresh && !escapes_) {
+            complete_string({ begin, static_cast<std::size_t>(p - begin) });
+        } else {
+            buffer_.append(begin, p);
+            complete_string(escapes_ ? decode(buffer_, p) : std::string_view { buffer_ });
+        }
+        return p + 1; // Skip closing quote
+    }
+
+    // Complete raw string is decoded as the lexer does it, end of string reads as closing quote.
+    // Errors are reported at the closing quote at `at`.
+    [[nodiscard]] std::string_view decode(std::string_view raw, const char* at)
+    {
+        decoded_.clear();
+        std::size_t i = 0;
+        const auto next = [&] { return i < raw.size() ? raw[i++] : '"'; };
+        while (i < raw.size()) {
+            const auto backslash = std::min(raw.find('\\', i), raw.size());
+            decoded_.append(raw.substr(i, backslash - i));
+            if (backslash == raw.size()) {
+                break;
+            }
+            i = backslash + 1;
+            char decoded[4];
+            decoded_.append(decoded, lexer::decode_escape(next, decoded, failure { this, at }));
+        }
+        return decoded_;
+    }
+
+    // Value of a recorded error is dropped
+    void complete_string(std::string_view str)
+    {
+        if (error_) {
+            return;
+        }
+        if (key_) {
+            handler_.on_key(str);
+            state_ = grammar::after(state_, true);
+        } else {
+            handler_.on_string(str);
+            after_value();
+        }
+    }
+
+    const char* scan_number(const char* p, const char* end, bool fresh)
+    {
+        const char* const last = std::find_if_not(p, end, lexer::is_number_char);
+        if (fresh) {
+            buffer_.clear();
+        }
+        if (last == end) {
+            partial_ = partial_token::NUMBER;
+            buffer_.append(p, end);
+            return end;
+        }
+        partial_ = partial_token::NONE;
+        if (fresh) {
+            complete_number(p, last, last);
+        } else {
+            buffer_.append(p, last);
+            complete_number(buffer_.data(), buffer_.data() + buffer_.size(), last);
+        }
+        return last;
+    }
+
+    // Errors are reported at `at` after the number, value of a recorded error is dropped
+    void complete_number(const char* first, const char* last, const char* at)
+    {
+        const auto number = lexer::convert_number(first, last, failure { this, at });
+        if (error_) {
+            return;
+        }
+        std::visit([this](auto value) {
+            if constexpr (std::is_same_v<decltype(value), int64_t>) {
+                handler_.on_int(value);
+            } else {
+                handler_.on_double(value);
+            }
+        },
+            number);
+        after_value();
+    }
+
+    Handler handler_;
+    parser_options options_;
+    state state_ = state::VALUE;
+    // Open containers, true for objects
+    std::vector<bool> containers_;
+    // Token cut by fragment edge and its raw bytes collected so far
+    partial_token partial_ = partial_token::NONE;
+    std::string buffer_;
+    // Storage for decoded strings with escapes
+    std::string decoded_;
+    // String being scanned is an object key
+    bool key_ = false;
+    // String has escape sequences
+    bool escapes_ = false;
+    // Backslash was the last byte of the previous fragment
+    bool escaped_ = false;
+    // Bytes of the fragments fed before the current one, which starts at `fragment_` during feed()
+    std::size_t fed_ = 0;
+    const char* fragment_ = nullptr;
+    std::optional<error> error_;
+};
+
+// SAX-style parsing and validation drive the grammar by peeked tokens. Validation checks strings and numbers
+// without decoding or converting them, so only container events reach the handler.
+template <bool Validate, typename Handler>
+void walk_events(lexer& lexer, Handler&& handler)
+{
+    using token_type = lexer::token_type;
+    // Open containers, true for objects
+    std::vector<bool> containers;
+    // Innermost container is an object
+    bool object = false;
+    auto state = grammar::state::VALUE;
+    while (state != grammar::state::DONE) {
+        const auto type = lexer.peek_type();
+        switch (grammar::next(state, type, object)) {
+        case grammar::step::VALUE:
+            if constexpr (stats_enabled) {
+                if (!containers.empty() && !object) {
+                    ++local_stats().elements;
+                }
+            }
+            if (type == token_type::OBJECT_BEGIN || type == token_type::ARRAY_BEGIN) {
+                lexer.consume_token(type);
+                object = type == token_type::OBJECT_BEGIN;
+                containers.push_back(object);
+                if (object) {
+                    handler.on_begin_object();
+                } else {
+                    handler.on_begin_array();
+                }
+                state = grammar::begin(object);
+                break;
+            }
+            if (type == token_type::STRING) {
+                if constexpr (Validate) {
+                    lexer.check_string();
+                } else {
+                    handler.on_string(lexer.next_string());
+                }
+            } else if constexpr (Validate) {
+                lexer.check_number();
+            } else {
+                std::visit([&](auto number) {
+                    if constexpr (std::is_same_v<decltype(number), int64_t>) {
+                        handler.on_int(number);
+                    } else {
+                        handler.on_double(number);
+                    }
+                },
+                    lexer.next_number());
+            }
+            state = grammar::after_value(!containers.empty());
+            break;
+        case grammar::step::KEY:
+            if constexpr (stats_enabled) {
+                ++local_stats().pairs;
+            }
+            if constexpr (Validate) {
+                lexer.check_string();
+            } else {
+                handler.on_key(lexer.next_string());
+            }
+            // Colon always follows a key, take it without another round
+            if (const auto colon = lexer.peek_type(); grammar::next(grammar::state::COLON, colon, true) != grammar::step::PUNCTUATION) {
+                lexer.fail(grammar::error(grammar::state::COLON, true));
+                return;
+            }
+            lexer.consume_token(token_type::COLON);
+            state = grammar::state::VALUE;
+            break;
+        case grammar::step::PUNCTUATION:
+            lexer.consume_token(type);
+            state = grammar::after(state, object);
+            break;
+        case grammar::step::END:
+            lexer.consume_token(type);
+            containers.pop_back();
+            if (object) {
+                handler.on_end_object();
+            } else {
+                handler.on_end_array();
+            }
+            object = !containers.empty() && containers.back();
+            state = grammar::after_value(!containers.empty());
+            break;
+        case grammar::step::ERROR:
+            lexer.fail(grammar::error(state, object));
+            return;
+        }
+    }
+}
+
+// SAX-style parsing driven straight off the lexer: values are passed to the handler as they are lexed,
+// no json variant or stream is constructed. Handler has the same callbacks as for push_parser,
+// it is a template parameter, so calls are inlined. Open containers are kept on explicit stack.
+template <typename Handler>
+void parse_events(lexer& lexer, Handler&& handler)
+{
+    walk_events<false>(lexer, std::forward<Handler>(handler));
+}
+
+// Result of validation, error is empty for valid input
+struct validation_result {
+    std::string error;
+    // Byte offset where the error was detected
+    std::size_t offset = 0;
+
+    [[nodiscard]] explicit operator bool() const noexcept
+    {
+        return error.empty();
+    }
+};
+
+// Checks that input is exactly one JSON value without building tokens, strings or numbers.
+// Lexer records the first error instead of throwing it, so it is returned with its position.
+inline validation_result validate(std::unique_ptr<source> input)
+{
+    struct container_events {
+        void on_begin_object() { }
+        void on_end_object() { }
+        void on_begin_array() { }
+        void on_end_array() { }
+    };
+    lexer lexer { std::move(input), { .throw_errors = false } };
+    walk_events<true>(lexer, container_events {});
+    if (lexer.peek_type() != lexer::token_type::END_OF_INPUT) {
+        lexer.fail(error_code::UNEXPECTED_DATA_AFTER_VALUE);
+    }
+    if (const auto& e = lexer.last_error()) {
+        return { parse_error { *e }.what(), e->offset };
+    }
+    return {};
+}
+
+// Awaitable streaming API for event loops interleaving many slow inputs on one thread.
+// Event loop feeds fragments to async_parser, which resumes the consumer coroutine once the value
+// it awaits is complete. Consumer runs until it needs more input and suspends again,
+// so only events of fed but not yet consumed fragments are buffered, never the whole document.
+class async_parser;
+class async_object_stream;
+class async_array_stream;
+
+using async_json = std::variant<int64_t, double, std::string, async_object_stream, async_array_stream>;
+
+// Awaiting suspends until the parser has the next value of the stream
+template <typename Stream>
+struct stream_awaiter {
+    Stream* stream;
+
+    [[nodiscard]] bool await_ready() const { return stream->ready(); }
+    void await_suspend(std::coroutine_handle<> handle) const { stream->wait(handle); }
+};
+
+template <typename Stream>
+struct next_awaiter : stream_awaiter<Stream> {
+    [[nodiscard]] std::optional<typename Stream::value_type> await_resume() const { return this->stream->take(); }
+};
+
+// Iterator of async stream, both begin() and increment are awaited:
+// for (auto it = co_await stream.begin(); it != stream.end(); co_await ++it)
+template <typename Stream>
+class async_iterator {
+public:
+    using value_type = typename Stream::value_type;
+
+    struct begin_awaiter : stream_awaiter<Stream> {
+        [[nodiscard]] async_iterator await_resume() const
+        {
+            async_iterator it { this->stream };
+            it.value_ = this->stream->take();
+            return it;
+        }
+    };
+
+    struct increment_awaiter : stream_awaiter<Stream> {
+        async_iterator* it;
+
+        async_iterator& await_resume() const
+        {
+            it->value_ = this->stream->take();
+            return *it;
+        }
+    };
+
+    [[nodiscard]] value_type& operator*() { return *value_; }
+    [[nodiscard]] value_type* operator->() { return &*value_; }
+
+    [[nodiscard]] increment_awaiter operator++() { return { { stream_ }, this }; }
+
+    [[nodiscard]] bool operator==(std::default_sentinel_t) const noexcept { return !value_; }
+
+private:
+    explicit async_iterator(Stream* stream)
+        : stream_ { stream }
+    {
+    }
+
+    Stream* stream_;
+    std::optional<value_type> value_;
+};
+
+// Streaming JSON object parser resumed as input arrives
+class async_object_stream {
+public:
+    using value_type = std::pair<std::string, async_json>;
+    using iterator = async_iterator<async_object_stream>;
+
+    // Awaitable next pair, std::nullopt after the end of object
+    [[nodiscard]] auto next();
+    [[nodiscard]] auto begin();
+    [[nodiscard]] std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+    async_object_stream(async_parser& parser, std::size_t depth)
+        : parser_ { &parser }
+        , depth_ { depth }
+    {
+    }
+
+    friend class async_parser;
+    friend struct stream_awaiter<async_object_stream>;
+    friend struct next_awaiter<async_object_stream>;
+    friend class async_iterator<async_object_stream>;
+
+    [[nodiscard]] bool ready() const;
+    void wait(std::coroutine_handle<> handle);
+    [[nodiscard]] std::optional<value_type> take();
+
+    async_parser* parser_;
+    // Parser depth inside of this object
+    std::size_t depth_;
+    bool finished_ = false;
+};
+
+// Streaming JSON array parser resumed as input arrives
+class async_array_stream {
+public:
+    using value_type = async_json;
+    using iterator = async_iterator<async_array_stream>;
+
+    // Awaitable next element, std::nullopt after the end of array
+    [[nodiscard]] auto next();
+    [[nodiscard]] auto begin();
+    [[nodiscard]] std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+    async_array_stream(async_parser& parser, std::size_t depth)
+        : parser_ { &parser }
+        , depth_ { depth }
+    {
+    }
+
+    friend class async_parser;
+    friend struct stream_awaiter<async_array_stream>;
+    friend struct next_awaiter<async_array_stream>;
+    friend class async_iterator<async_array_stream>;
+
+    [[nodiscard]] bool ready() const;
+    void wait(std::coroutine_handle<> handle);
+    [[nodiscard]] std::optional<value_type> take();
+
+    async_parser* parser_;
+    std::size_t depth_;
+    bool finished_ = false;
+};
+
+// Push parser queueing events for async streams. Events of values left unread by the consumer
+// are dropped when it asks for the next value of an enclosing stream, like skip_to_depth() does.
+// Parsing errors are recorded, feed() never throws. The consumer awaiting a value past the error
+// is resumed and the error is thrown inside it, so async_task::get() reports it.
+class async_parser {
+public:
+    async_parser()
+        : parser_ { queue_, { .throw_errors = false } }
+    {
+    }
+    // Streams point to the parser, so it must stay in place
+    async_parser(const async_parser&) = delete;
+    async_parser& operator=(const async_parser&) = delete;
+
+    // Parse next fragment, then resume the consumer if the value it awaits is complete or failed
+    void feed(std::span<const char> fragment)
+    {
+        parser_.feed(fragment);
+        resume();
+    }
+
+    void finish()
+    {
+        parser_.finish();
+        resume();
+    }
+
+    // Read error of the event loop's input ends it like a parsing error
+    void fail_read(int system_error)
+    {
+        parser_.fail_read(system_error);
+        resume();
+    }
+
+    // Top-level value is parsed, the consumer may still be reading it
+    [[nodiscard]] bool done() const noexcept
+    {
+        return parser_.done();
+    }
+
+    // First parsing error, it is also thrown in the consumer awaiting past it
+    [[nodiscard]] const std::optional<error>& last_error() const noexcept
+    {
+        return parser_.last_error();
+    }
+
+    // Awaitable top-level value
+    [[nodiscard]] auto root()
+    {
+        struct root_awaiter {
+            async_parser* parser;
+
+            [[nodiscard]] bool await_ready() const { return parser->ready(0, false); }
+            void await_suspend(std::coroutine_handle<> handle) const { parser->wait(0, false, handle); }
+            [[nodiscard]] async_json await_resume() const { return parser->take_value(); }
+        };
+        return root_awaiter { this };
+    }
+
+private:
+    using token_type = lexer::token_type;
+
+    struct event {
+        token_type type;
+        std::string text;
+        lexer::number number;
+    };
+
+    // Handler of the push parser, both keys and string values are queued as STRING
+    struct event_queue {
+        std::deque<event> events;
+
+        void on_begin_object() { events.push_back({ token_type::OBJECT_BEGIN, {}, {} }); }
+        void on_end_object() { events.push_back({ token_type::OBJECT_END, {}, {} }); }
+        void on_begin_array() { events.push_back({ token_type::ARRAY_BEGIN, {}, {} }); }
+        void on_end_array() { events.push_back({ token_type::ARRAY_END, {}, {} }); }
+        void on_key(std::string_view key) { events.push_back({ token_type::STRING, std::string { key }, {} }); }
+        void on_string(std::string_view str) { events.push_back({ token_type::STRING, std::string { str }, {} }); }
+        void on_int(int64_t number) { events.push_back({ token_type::NUMBER, {}, number }); }
+        void on_double(double number) { events.push_back({ token_type::NUMBER, {}, number }); }
+    };
+
+    friend class async_object_stream;
+    friend class async_array_stream;
+
+    // Next value of a stream at `depth` is queued, object pair needs both key and value events.
+    // After an error no more events come, so the consumer is resumed to get the error.
+    [[nodiscard]] bool ready(std::size_t depth, bool object)
+    {
+        auto& events = queue_.events;
+        while (depth_ > depth && !events.empty()) {
+            (void)pop();
+        }
+        if (depth_ > depth || events.empty()) {
+            return parser_.last_error().has_value();
+        }
+        return !object || events.size() >= 2 || events.front().type == token_type::OBJECT_END || parser_.last_error();
+    }
+
+    // Consumer resumed by an error reads past the queued events
+    void check_queued() const
+    {
+        if (queue_.events.empty()) {
+            assert(parser_.last_error() && "Value is awaited before it is ready");
+            raise(parse_error { *parser_.last_error() });
+        }
+    }
+
+    void wait(std::size_t depth, bool object, std::coroutine_handle<> handle)
+    {
+        assert(!waiting_ && "Only one coroutine may consume the document");
+        waiting_ = handle;
+        waiting_depth_ = depth;
+        waiting_object_ = object;
+    }
+
+    void resume()
+    {
+        if (waiting_ && ready(waiting_depth_, waiting_object_)) {
+            std::exchange(waiting_, {}).resume();
+        }
+    }
+
+    [[nodiscard]] event pop()
+    {
+        auto next = std::move(queue_.events.front());
+        queue_.events.pop_front();
+        if (next.type == token_type::OBJECT_BEGIN || next.type == token_type::ARRAY_BEGIN) {
+            ++depth_;
+        } else if (next.type == token_type::OBJECT_END || next.type == token_type::ARRAY_END) {
+            --depth_;
+        }
+        return next;
+    }
+
+    [[nodiscard]] async_json take_value()
+    {
+        check_queued();
+        auto next = pop();
+        switch (next.type) {
+        case token_type::OBJECT_BEGIN:
+            return async_object_stream { *this, depth_ };
+        case token_type::ARRAY_BEGIN:
+            return async_array_stream { *this, depth_ };
+        case token_type::STRING:
+            return std::move(next.text);
+        default:
+            return std::visit([](auto number) -> async_json { return number; }, next.number);
+        }
+    }
+
+    event_queue queue_;
+    push_parser<event_queue&> parser_;
+    // Nesting depth of containers opened by consumed events
+    std::size_t depth_ = 0;
+    // Suspended consumer and the stream it waits on
+    std::coroutine_handle<> waiting_;
+    std::size_t waiting_depth_ = 0;
+    bool waiting_object_ = false;
+};
+
+inline auto async_object_stream::next() { return next_awaiter<async_object_stream> { { this } }; }
+inline auto async_object_stream::begin() { return iterator::begin_awaiter { { this } }; }
+
+inline bool async_object_stream::ready() const
+{
+    return finished_ || parser_->ready(depth_, true);
+}
+
+inline void async_object_stream::wait(std::coroutine_handle<> handle)
+{
+    parser_->wait(depth_, true, handle);
+}
+
+inline std::optional<async_object_stream::value_type> async_object_stream::take()
+{
+    if (!finished_) {
+        parser_->check_queued();
+    }
+    if (finished_ || parser_->queue_.events.front().type == lexer::token_type::OBJECT_END) {
+        if (!std::exchange(finished_, true)) {
+            (void)parser_->pop();
+        }
+        return std::nullopt;
+    }
+    auto key = std::move(parser_->pop().text);
+    return value_type { std::move(key), parser_->take_value() };
+}
+
+inline auto async_array_stream::next() { return next_awaiter<async_array_stream> { { this } }; }
+inline auto async_array_stream::begin() { return iterator::begin_awaiter { { this } }; }
+
+inline bool async_array_stream::ready() const
+{
+    return finished_ || parser_->ready(depth_, false);
+}
+
+inline void async_array_stream::wait(std::coroutine_handle<> handle)
+{
+    parser_->wait(depth_, false, handle);
+}
+
+inline std::optional<async_array_stream::value_type> async_array_stream::take()
+{
+    if (!finished_) {
+        parser_->check_queued();
+    }
+    if (finished_ || parser_->queue_.events.front().type == lexer::token_type::ARRAY_END) {
+        if (!std::exchange(finished_, true)) {
+            (void)parser_->pop();
+        }
+        return std::nullopt;
+    }
+    return parser_->take_value();
+}
+
+// Coroutine consuming async streams: starts eagerly, is resumed by async_parser
+// and keeps exception of the consumer until get()
+class async_task {
+public:
+    struct promise_type {
+        std::exception_ptr exception;
+
+        async_task get_return_object() { return async_task { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() noexcept { }
+        void unhandled_exception() noexcept { exception = std::current_exception(); }
+    };
+
+    async_task(async_task&& other) noexcept
+        : handle_ { std::exchange(other.handle_, {}) }
+    {
+    }
+    async_task& operator=(async_task&&) = delete;
+    ~async_task()
+    {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    [[nodiscard]] bool done() const noexcept
+    {
+        return handle_.done();
+    }
+
+    // Rethrows exception of the finished consumer
+    void get() const
+    {
+        assert(done() && "Consumer is still waiting for input");
+        if (handle_.promise().exception) {
+            std::rethrow_exception(handle_.promise().exception);
+        }
+    }
+
+private:
+    explicit async_task(std::coroutine_handle<promise_type> handle)
+        : handle_ { handle }
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Forward declarations of parsing support types
+class object_stream;
+class array_stream;
+using json = std::variant<int64_t, double, std::string, object_stream, array_stream>;
+template <typename Value, typename Parser>
+class iterator;
+
+// Parser context owns the lexer shared by all streams of a document.
+// Streams only borrow the lexer, so context must outlive them (checked in debug builds).
+class parser {
+public:
+    explicit parser(std::unique_ptr<source> src, parser_options options = {})
+        : lexer_ { std::move(src), options }
+    {
+    }
+    // Streams point to the lexer, so context must stay in place
+    parser(const parser&) = delete;
+    parser& operator=(const parser&) = delete;
+
+    // Parse next value from the input
+    [[nodiscard]] json parse();
+
+    // Parse next value, getting the error of its first token by value when errors are not thrown.
+    // Errors inside containers are returned by try_next() of their streams.
+    [[nodiscard]] std::expected<json, error> try_parse();
+
+    // First parsing error, recorded only when errors are not thrown
+    [[nodiscard]] const std::optional<error>& last_error() const noexcept
+    {
+        return lexer_.last_error();
+    }
+
+    // Skip next value of the input without building tokens
+    void skip()
+    {
+        lexer_.skip_value();
+    }
+
+    // Keys interned by object_stream::next_interned_key()
+    [[nodiscard]] key_pool& keys() noexcept
+    {
+        return lexer_.keys();
+    }
+
+private:
+    friend json parse(std::unique_ptr<source> src);
+
+    lexer lexer_;
+};
+
+// Non-owning reference to the lexer held by streams instead of shared ownership.
+// Root value returned by json::parse() keeps its parser context alive through it.
+class lexer_ref {
+public:
+    explicit lexer_ref(lexer& lex, std::unique_ptr<parser> owner = nullptr)
+        : lexer_ { &lex }
+        , owner_ { std::move(owner) }
+    {
+#ifndef NDEBUG
+        ++lexer_->borrowers_;
+#endif
+    }
+    lexer_ref(lexer_ref&& other) noexcept
+        : lexer_ { std::exchange(other.lexer_, nullptr) }
+        , owner_ { std::move(other.owner_) }
+    {
+    }
+    lexer_ref& operator=(lexer_ref&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            lexer_ = std::exchange(other.lexer_, nullptr);
+            owner_ = std::move(other.owner_);
+        }
+        return *this;
+    }
+    ~lexer_ref()
+    {
+        release();
+    }
+
+    [[nodiscard]] explicit operator bool() const noexcept
+    {
+        return lexer_ != nullptr;
+    }
+
+    [[nodiscard]] lexer* operator->() const noexcept
+    {
+        assert(lexer_ && "Use of moved-from stream");
+        return lexer_;
+    }
+
+    [[nodiscard]] lexer& operator*() const noexcept
+    {
+        return *operator->();
+    }
+
+private:
+    void release() noexcept
+    {
+#ifndef NDEBUG
+        if (lexer_) {
+            --lexer_->borrowers_;
+        }
+#endif
+        lexer_ = nullptr;
+        owner_.reset();
+    }
+
+    lexer* lexer_;
+    std::unique_ptr<parser> owner_;
+};
+
+// Streaming JSON object parser
+class object_stream {
+public:
+    using value_type = std::pair<std::string, json>;
+    using iterator = ::json::iterator<value_type, object_stream>;
+
+    explicit object_stream(lexer_ref&& lex)
+        : lexer_ { std::move(lex) }
+    {
+        // Consume opening brace
+        if (!lexer_->try_consume_token(lexer::token_type::OBJECT_BEGIN)) {
+            lexer_->fail(error_code::EXPECTED_OBJECT);
+            finished_ = true;
+        }
+        depth_ = lexer_->depth();
+    }
+    // Copying would make two parsers consuming the same stream
+    object_stream(const object_stream&) = delete;
+    object_stream& operator=(const object_stream&) = delete;
+    object_stream(object_stream&&) = default;
+    object_stream& operator=(object_stream&&) = default;
+    // Unconsumed remainder is skipped, see parser_options::drain_unconsumed
+    ~object_stream();
+
+    [[nodiscard]] iterator begin();
+    [[nodiscard]] std::default_sentinel_t end();
+
+    // Skip unconsumed remainder without building tokens
+    void skip();
+
+    // Next pair with the error by value when errors are not thrown, std::nullopt after last pair.
+    // Iterators just end at a recorded error.
+    [[nodiscard]] std::expected<std::optional<value_type>, error> try_next();
+
+    // Pair by pair iteration for consumers selecting values by key:
+    // each key is followed by exactly one read_value() or skip_value().
+    // Key view is valid until the next token, std::nullopt after last pair.
+    [[nodiscard]] std::optional<std::string_view> next_key();
+    // Same as next_key() with the key interned in the parser's key_pool:
+    // view stays valid as long as the parser, equal keys of all objects share one id.
+    [[nodiscard]] std::optional<key_pool::key> next_interned_key();
+    [[nodiscard]] json read_value();
+    void skip_value();
+    // Pass value to the visitor without materializing scalars, see json::visit_value()
+    template <typename Visitor>
+    void visit_value(Visitor&& visitor);
+    // Pass scalar as its source bytes, see json::visit_raw_value()
+    template <typename Visitor>
+    void visit_raw_value(Visitor&& visitor);
+
+private:
+    friend iterator;
+    // Get next value checking languages grammatics.
+    // Returns std::nullopt after last value.
+    [[nodiscard]] std::optional<value_type> next_value();
+    void consume_colon();
+
+    lexer_ref lexer_;
+    // Lexer nesting depth inside this object
+    std::size_t depth_ = 0;
+    int uncaught_exceptions_ = std::uncaught_exceptions();
+    // Colon and value are read by the caller, so the state goes from key to separator
+    grammar::state state_ = grammar::state::FIRST_KEY;
+    bool finished_ = false;
+};
+
+// Streaming JSON array parser
+class array_stream {
+public:
+    using value_type = json;
+    using iterator = ::json::iterator<value_type, array_stream>;
+
+    explicit array_stream(lexer_ref&& lex)
+        : lexer_ { std::move(lex) }
+    {
+        // Consume opening bracket
+        if (!lexer_->try_consume_token(lexer::token_type::ARRAY_BEGIN)) {
+            lexer_->fail(error_code::EXPECTED_ARRAY);
+            finished_ = true;
+        }
+        depth_ = lexer_->depth();
+    }
+    // Copying would make two parsers consuming the same stream
+    array_stream(const array_stream&) = delete;
+    array_stream& operator=(const array_stream&) = delete;
+    array_stream(array_stream&&) = default;
+    array_stream& operator=(array_stream&&) = default;
+    // Unconsumed remainder is skipped, see parser_options::drain_unconsumed
+    ~array_stream();
+
+    [[nodiscard]] iterator begin();
+    [[nodiscard]] std::default_sentinel_t end();
+
+    // Skip unconsumed remainder without building tokens
+    void skip();
+
+    // Next element with the error by value when errors are not thrown, std::nullopt after last element.
+    // Iterators just end at a recorded error.
+    [[nodiscard]] std::expected<std::optional<value_type>, error> try_next();
+
+    // Element by element iteration for consumers selecting values by index:
+    // each true result is followed by exactly one read_value() or skip_value().
+    // Returns false after last element.
+    [[nodiscard]] bool next_element();
+    [[nodiscard]] json read_value();
+    void skip_value();
+    // Pass value to the visitor without materializing scalars, see json::visit_value()
+    template <typename Visitor>
+    void visit_value(Visitor&& visitor);
+    // Pass scalar as its source bytes, see json::visit_raw_value()
+    template <typename Visitor>
+    void visit_raw_value(Visitor&& visitor);
+
+private:
+    friend iterator;
+    // Get next value checking languages grammatics.
+    // Returns std::nullopt after last value.
+    [[nodiscard]] std::optional<value_type> next_value();
+
+    lexer_ref lexer_;
+    // Lexer nesting depth inside this array
+    std::size_t depth_ = 0;
+    int uncaught_exceptions_ = std::uncaught_exceptions();
+    // Value is read by the caller, so the state goes from value to separator
+    grammar::state state_ = grammar::state::FIRST_ELEMENT;
+    bool finished_ = false;
+};
+
+// Implements input_iterator-like interface
+template <typename Value, typename Parser>
+class iterator {
+public:
+    using value_type = Value;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    explicit iterator(Parser* parser)
+        : parser_ { parser }
+        , current_value_ { parser_->next_value() }
+    {
+    }
+
+    [[nodiscard]] bool operator==(const std::default_sentinel_t&) const
+    {
+        return !current_value_.has_value();
+    }
+
+    iterator& operator++()
+    {
+        // Previous value must skip its remainder before the next one is parsed
+        current_value_.reset();
+        current_value_ = parser_->next_value();
+        return *this;
+    }
+
+    // post-increment to conform std::input_iterator requirements
+    void operator++(int)
+    {
+        ++(*this);
+    }
+
+    [[nodiscard]] value_type& operator*() const
+    {
+        return *current_value_;
+    }
+
+private:
+    Parser* parser_ = nullptr;
+    mutable std::optional<value_type> current_value_;
+};
+
+// Streams top-level values of newline delimited or concatenated JSON documents.
+// All records share one lexer and its input buffer, unconsumed remainder
+// of a record is skipped before the next one, see parser_options::drain_unconsumed.
+class ndjson_stream {
+public:
+    struct record {
+        json value;
+        // Position of the first byte of the record, line is one-based
+        std::size_t offset;
+        std::size_t line;
+    };
+    using value_type = record;
+    using iterator = ::json::iterator<value_type, ndjson_stream>;
+
+    explicit ndjson_stream(std::unique_ptr<source> src, parser_options options = {})
+        : lexer_ { std::move(src), options }
+    {
+        lexer_.track_lines();
+    }
+    // Records point to the lexer, so stream must stay in place
+    ndjson_stream(const ndjson_stream&) = delete;
+    ndjson_stream& operator=(const ndjson_stream&) = delete;
+
+    [[nodiscard]] iterator begin();
+    [[nodiscard]] std::default_sentinel_t end();
+
+    // Keys interned by object_stream::next_interned_key() are shared by all records
+    [[nodiscard]] key_pool& keys() noexcept
+    {
+        return lexer_.keys();
+    }
+
+private:
+    friend iterator;
+    // Returns std::nullopt at the end of input
+    [[nodiscard]] std::optional<value_type> next_value();
+
+    lexer lexer_;
+};
+
+// Pass next value to the visitor without materializing scalars: numbers as int64_t or double,
+// strings as std::string_view valid until the next token, containers as streams.
+template <typename Visitor>
+auto visit_value(lexer_ref lexer, Visitor&& visitor)
+{
+    switch (lexer->peek_type()) {
+    case lexer::token_type::STRING:
+        return visitor(lexer->next_string());
+    case lexer::token_type::NUMBER:
+        return std::visit(visitor, lexer->next_number());
+    case lexer::token_type::OBJECT_BEGIN:
+        return visitor(object_stream { std::move(lexer) });
+    case lexer::token_type::ARRAY_BEGIN:
+        return visitor(array_stream { std::move(lexer) });
+    default:
+        lexer->fail(error_code::EXPECTED_VALUE);
+        // Placeholder for the missing value once the error is recorded
+        return visitor(int64_t { 0 });
+    }
+}
+
+// Scalar token as it was written in the input, see json::visit_raw_value()
+struct raw_scalar {
+    lexer::token_type type;
+    std::string_view bytes;
+};
+
+// Same as visit_value() with scalars passed as raw_scalar valid until the next token:
+// tokens are checked but not decoded or converted, so they are copied to output unchanged.
+template <typename Visitor>
+auto visit_raw_value(lexer_ref lexer, Visitor&& visitor)
+{
+    switch (lexer->peek_type()) {
+    case lexer::token_type::STRING:
+        return visitor(raw_scalar { lexer::token_type::STRING, lexer->next_raw_string() });
+    case lexer::token_type::NUMBER:
+        return visitor(raw_scalar { lexer::token_type::NUMBER, lexer->next_raw_number() });
+    case lexer::token_type::OBJECT_BEGIN:
+        return visitor(object_stream { std::move(lexer) });
+    case lexer::token_type::ARRAY_BEGIN:
+        return visitor(array_stream { std::move(lexer) });
+    default:
+        lexer->fail(error_code::EXPECTED_VALUE);
+        return visitor(raw_scalar { lexer::token_type::NUMBER, "0" });
+    }
+}
+
+json parse_value(lexer_ref lexer)
+{
+    return visit_value(std::move(lexer), [](auto&& v) -> json {
+        if constexpr (std::is_same_v<std::decay_t<decltype(v)>, std::string_view>) {
+            std::string value { v };
+            if constexpr (stats_enabled) {
+                local_stats().allocations += value.capacity() > std::string {}.capacity();
+            }
+            return value;
+        } else {
+            return std::move(v);
+        }
+    });
+}
+
+template <typename Visitor>
+void object_stream::visit_value(Visitor&& visitor)
+{
+    consume_colon();
+    ::json::visit_value(lexer_ref { *lexer_ }, std::forward<Visitor>(visitor));
+}
+
+template <typename Visitor>
+void array_stream::visit_value(Visitor&& visitor)
+{
+    ::json::visit_value(lexer_ref { *lexer_ }, std::forward<Visitor>(visitor));
+}
+
+template <typename Visitor>
+void object_stream::visit_raw_value(Visitor&& visitor)
+{
+    consume_colon();
+    ::json::visit_raw_value(lexer_ref { *lexer_ }, std::forward<Visitor>(visitor));
+}
+
+template <typename Visitor>
+void array_stream::visit_raw_value(Visitor&& visitor)
+{
+    ::json::visit_raw_value(lexer_ref { *lexer_ }, std::forward<Visitor>(visitor));
+}
+
+auto object_stream::begin() -> iterator { return iterator { this }; }
+auto object_stream::end() -> std::default_sentinel_t { return std::default_sentinel_t {}; }
+
+object_stream::~object_stream()
+{
+    // Draining is pointless while exception unwinds the parser
+    if (lexer_ && !finished_ && lexer_->options().drain_unconsumed && std::uncaught_exceptions() == uncaught_exceptions_) {
+        JSON_TRY {
+            skip();
+        } JSON_CATCH(const parse_error&) {
+            // Malformed remainder is reported by the parent stream
+        }
+    }
+}
+
+void object_stream::skip()
+{
+    if (!std::exchange(finished_, true)) {
+        lexer_->skip_to_depth(depth_ - 1);
+    }
+}
+
+std::optional<std::string_view> object_stream::next_key()
+{
+    if (finished_) {
+        return std::nullopt;
+    }
+    // Local state is not reloaded around lexer calls, so steps after the separator are folded
+    auto state = state_;
+    auto type = lexer_->peek_type();
+    auto step = grammar::next(state, type, true);
+    if (step == grammar::step::PUNCTUATION) {
+        lexer_->consume_token(type);
+        state = grammar::after(state, true);
+        type = lexer_->peek_type();
+        step = grammar::next(state, type, true);
+    }
+    if (step == grammar::step::END) {
+        lexer_->consume_token(type);
+        finished_ = true;
+        return std::nullopt;
+    }
+    if (step != grammar::step::KEY) {
+        lexer_->fail(grammar::error(state, true));
+        finished_ = true;
+        return std::nullopt;
+    }
+    state_ = grammar::state::SEPARATOR;
+    if constexpr (stats_enabled) {
+        ++local_stats().pairs;
+    }
+    return lexer_->next_string();
+}
+
+std::optional<key_pool::key> object_stream::next_interned_key()
+{
+    return next_key().transform([&](auto key) { return lexer_->keys().intern(key); });
+}
+
+json object_stream::read_value()
+{
+    consume_colon();
+    return parse_value(lexer_ref { *lexer_ });
+}
+
+void object_stream::skip_value()
+{
+    consume_colon();
+    lexer_->skip_value();
+}
+
+void object_stream::consume_colon()
+{
+    if (!lexer_->try_consume_token(lexer::token_type::COLON)) {
+        lexer_->fail(error_code::EXPECTED_COLON);
+    }
+}
+
+std::optional<object_stream::value_type> object_stream::next_value()
+{
+    auto pair = next_key()
+                    // key view is valid only until the next token, so copy it before reading the value
+                    .transform([](auto key) { return std::string { key }; })
+                    .transform([&](auto&& key) { return object_stream::value_type(std::move(key), read_value()); });
+    // Value read after a recorded error is a placeholder
+    if (lexer_->last_error()) {
+        finished_ = true;
+        return std::nullopt;
+    }
+    return pair;
+}
+
+auto object_stream::try_next() -> std::expected<std::optional<value_type>, error>
+{
+    auto pair = next_value();
+    if (const auto& e = lexer_->last_error()) {
+        return std::unexpected(*e);
+    }
+    return pair;
+}
+
+auto array_stream::begin() -> iterator { return iterator { this }; }
+auto array_stream::end() -> std::default_sentinel_t { return std::default_sentinel_t {}; }
+
+array_stream::~array_stream()
+{
+    // Draining is pointless while exception unwinds the parser
+    if (lexer_ && !finished_ && lexer_->options().drain_unconsumed && std::uncaught_exceptions() == uncaught_exceptions_) {
+        JSON_TRY {
+            skip();
+        } JSON_CATCH(const parse_error&) {
+            // Malformed remainder is reported by the parent stream
+        }
+    }
+}
+
+void array_stream::skip()
+{
+    if (!std::exchange(finished_, true)) {
+        lexer_->skip_to_depth(depth_ - 1);
+    }
+}
+
+bool array_stream::next_element()
+{
+    if (finished_) {
+        return false;
+    }
+    // Local state is not reloaded around lexer calls, so steps after the separator are folded
+    auto state = state_;
+    auto type = lexer_->peek_type();
+    auto step = grammar::next(state, type, false);
+    if (step == grammar::step::PUNCTUATION) {
+        lexer_->consume_token(type);
+        state = grammar::after(state, false);
+        type = lexer_->peek_type();
+        step = grammar::next(state, type, false);
+    }
+    if (step == grammar::step::END) {
+        lexer_->consume_token(type);
+        finished_ = true;
+        return false;
+    }
+    if (step != grammar::step::VALUE) {
+        lexer_->fail(grammar::error(state, false));
+        finished_ = true;
+        return false;
+    }
+    state_ = grammar::state::SEPARATOR;
+    if constexpr (stats_enabled) {
+        ++local_stats().elements;
+    }
+    return true;
+}
+
+json array_stream::read_value()
+{
+    return parse_value(lexer_ref { *lexer_ });
+}
+
+void array_stream::skip_value()
+{
+    lexer_->skip_value();
+}
+
+std::optional<json> array_stream::next_value()
+{
+    if (!next_element()) {
+        return std::nullopt;
+    }
+    auto value = read_value();
+    // Value read after a recorded error is a placeholder
+    if (lexer_->last_error()) {
+        finished_ = true;
+        return std::nullopt;
+    }
+    return value;
+}
+
+auto array_stream::try_next() -> std::expected<std::optional<value_type>, error>
+{
+    auto value = next_value();
+    if (const auto& e = lexer_->last_error()) {
+        return std::unexpected(*e);
+    }
+    return value;
+}
 
 // Using concepts to verify parser implementation is ranges-compatible
 static_assert(std::input_iterator<iterator<object_stream::value_type, object_stream>>);
 static_assert(std::input_iterator<iterator<array_stream::value_type, array_stream>>);
 static_assert(std::ranges::input_range<object_stream>);
 static_assert(std::ranges::input_range<array_stream>);
+static_assert(std::ranges::input_range<ndjson_stream>);
+
+json parser::parse()
+{
+    return parse_value(lexer_ref { lexer_ });
+}
+
+std::expected<json, error> parser::try_parse()
+{
+    auto value = parse();
+    if (const auto& e = lexer_.last_error()) {
+        return std::unexpected(*e);
+    }
+    return value;
+}
+
+auto ndjson_stream::begin() -> iterator { return iterator { this }; }
+auto ndjson_stream::end() -> std::default_sentinel_t { return std::default_sentinel_t {}; }
+
+std::optional<ndjson_stream::value_type> ndjson_stream::next_value()
+{
+    // Previous record is drained, so only whitespace separates the next one
+    if (lexer_.peek_type() == lexer::token_type::END_OF_INPUT) {
+        return std::nullopt;
+    }
+    const auto position = lexer_.current_position();
+    return record { parse_value(lexer_ref { lexer_ }), position.offset, position.line };
+}
+
+// Skip unconsumed remainder of the value without building tokens
+void skip_value(json& value)
+{
+    std::visit([](auto& v) {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, object_stream> || std::is_same_v<T, array_stream>) {
+            v.skip();
+        }
+    },
+        value);
+}
+
+// Fixed size thread pool. Every worker owns a task queue and steals
+// from the back of the other queues when its own queue is empty.
+// Only queue mutexes are taken while workers are busy, the pool mutex only when one goes to sleep.
+class thread_pool {
+public:
+    explicit thread_pool(unsigned threads)
+    {
+        threads = std::max(threads, 1u);
+        for (unsigned i = 0; i < threads; ++i) {
+            queues_.push_back(std::make_unique<task_queue>());
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            workers_.emplace_back([this, i] { run(i); });
+        }
+    }
+    // Workers point to the pool, so it must stay in place
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // Finishes queued tasks before joining workers
+    ~thread_pool()
+    {
+        {
+            std::lock_guard lock { mutex_ };
+            stopping_ = true;
+        }
+        wakeup_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return workers_.size();
+    }
+
+    // Queue task round robin, its result or exception is passed through the future
+    template <typename Task>
+    [[nodiscard]] std::future<std::invoke_result_t<Task&>> submit(Task task)
+    {
+        std::packaged_task<std::invoke_result_t<Task&>()> packaged { std::move(task) };
+        auto future = packaged.get_future();
+        auto& queue = *queues_[next_queue_++ % queues_.size()];
+        {
+            std::lock_guard lock { queue.mutex };
+            queue.tasks.emplace_back(std::move(packaged));
+        }
+        // Queue mutex orders the push with the last pass of a worker going to sleep, see park()
+        if (sleepers_.load(std::memory_order_relaxed) != 0) {
+            // Sleeper checks the queues under the pool mutex, so taking it here cannot lose the notification
+            {
+                std::lock_guard lock { mutex_ };
+            }
+            wakeup_.notify_one();
+        }
+        return future;
+    }
+
+private:
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<std::move_only_function<void()>> tasks;
+    };
+
+    void run(std::size_t index)
+    {
+        for (;;) {
+            std::move_only_function<void()> task;
+            if (!try_pop(index, task) && !park(index, task)) {
+                return;
+            }
+            task();
+        }
+    }
+
+    // Pass over the queues found nothing, so the worker sleeps until a task is submitted.
+    // Sleeper is counted before its last pass, whose queue locks order it with every submit():
+    // either the pass finds the task or the submitter sees the sleeper.
+    // False when the pool stops with every queue empty.
+    bool park(std::size_t index, std::move_only_function<void()>& task)
+    {
+        std::unique_lock lock { mutex_ };
+        sleepers_.fetch_add(1, std::memory_order_relaxed);
+        wakeup_.wait(lock, [&] { return try_pop(index, task) || stopping_; });
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        return static_cast<bool>(task);
+    }
+
+    bool try_pop(std::size_t index, std::move_only_function<void()>& task)
+    {
+        for (std::size_t i = 0; i < queues_.size(); ++i) {
+            auto& queue = *queues_[(index + i) % queues_.size()];
+            std::lock_guard lock { queue.mutex };
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            // Own queue is consumed in submission order, stealing takes the latest task
+            if (i == 0) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            } else {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<task_queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> next_queue_ { 0 };
+    // Workers waiting in park(), changed under the pool mutex
+    std::atomic<unsigned> sleepers_ { 0 };
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+};
+
+struct parallel_options {
+    // Approximate size of input chunk processed by one task, chunks end at newlines
+    std::size_t chunk_size = std::size_t { 1 } << 20;
+    unsigned threads = std::thread::hardware_concurrency();
+};
+
+// Parallel processing of newline delimited records, a record must not contain newlines.
+// Input is split into chunks at newlines, process(ndjson_stream&) -> std::string runs
+// for every chunk on the pool, and write(std::string&) gets the results in input order.
+template <typename Process, typename Write>
+void parallel_ndjson(source& input, const parallel_options& options, Process process, Write write)
+{
+    const std::size_t chunk_size = std::max(options.chunk_size, std::size_t { 1 });
+    thread_pool pool { options.threads };
+    // Reorder buffer of results in input order, it bounds the number of chunks in flight
+    std::deque<std::future<std::string>> results;
+    const auto write_front = [&] {
+        auto block = results.front().get();
+        results.pop_front();
+        write(block);
+    };
+    // Task parses its own copy of the chunk, or the input chunk in place when `owned` is empty
+    const auto submit = [&](std::string owned, std::string_view chunk) {
+        if (results.size() == 2 * pool.size()) {
+            write_front();
+        }
+        results.push_back(pool.submit([&process, owned = std::move(owned), chunk] {
+            ndjson_stream records { std::make_unique<memory_source>(owned.empty() ? chunk : std::string_view { owned }) };
+            return process(records);
+        }));
+    };
+    // End of the first line ending after `size` bytes, or npos
+    const auto cut = [](std::string_view data, std::size_t size) {
+        const auto newline = data.size() < size ? std::string_view::npos : data.find('\n', size - 1);
+        return newline == std::string_view::npos ? newline : newline + 1;
+    };
+
+    // Incomplete chunk collected from small input chunks
+    std::string batch;
+    for (auto data = input.next_chunk(); !data.empty(); data = input.next_chunk()) {
+        // Large input chunks are split in place, so tasks reading them must finish before the next one is read
+        std::size_t borrowed = 0;
+        if (batch.empty()) {
+            for (auto end = cut(data, chunk_size); end != std::string_view::npos; end = cut(data, chunk_size)) {
+                submit({}, data.substr(0, end));
+                data.remove_prefix(end);
+                ++borrowed;
+            }
+        }
+        batch.append(data);
+        std::size_t copied = 0;
+        for (auto end = cut(batch, chunk_size); end != std::string_view::npos; end = cut(batch, chunk_size)) {
+            submit(batch.substr(0, end), {});
+            batch.erase(0, end);
+            ++copied;
+        }
+        // Borrowing tasks precede the copied ones, those already written are finished.
+        // Results stay in the reorder buffer, so other chunks keep being processed.
+        const auto borrowed_end = results.size() - std::min(copied, results.size());
+        for (auto i = borrowed_end - std::min(borrowed, borrowed_end); i != borrowed_end; ++i) {
+            results[i].wait();
+        }
+    }
+    if (!batch.empty()) {
+        submit(std::move(batch), {});
+    }
+    while (!results.empty()) {
+        write_front();
+    }
+    // Records read before a read error are written, then it is thrown as the lexer does
+    if (const int e = input.read_error()) {
+        raise(parse_error { error { error_code::READ_ERROR, 0, 0, e } });
+    }
+}
+
+// Selects values addressed by JSON Pointers (RFC 6901) from a streamed document.
+// Segment '*' matches any object key or array index.
+// Values outside of the pointers are skipped without building tokens.
+class query {
+public:
+    explicit query(const std::vector<std::string>& pointers)
+    {
+        for (const auto& text : pointers) {
+            pointers_.push_back(parse_pointer(text));
+        }
+    }
+
+    // Calls on_match(json&) for every selected value in document order.
+    // Pointer selecting a whole value takes precedence over pointers into it.
+    template <typename Callback>
+    void select(json& value, Callback&& on_match) const
+    {
+        std::vector<std::size_t> all(pointers_.size());
+        std::iota(all.begin(), all.end(), 0);
+        select_in(value, 0, all, on_match);
+    }
+
+private:
+    struct segment {
+        std::string key;
+        std::optional<std::size_t> index;
+        bool wildcard = false;
+
+        bool matches(std::string_view k) const { return wildcard || key == k; }
+        bool matches(std::size_t i) const { return wildcard || index == i; }
+    };
+    using pointer = std::vector<segment>;
+
+    static pointer parse_pointer(std::string_view pointer_text)
+    {
+        auto text = pointer_text;
+        if (!text.empty() && text.front() != '/') {
+            raise(parse_error { "Invalid JSON pointer: " + std::string { pointer_text } });
+        }
+        pointer result;
+        while (!text.empty()) {
+            text.remove_prefix(1);
+            const auto size = std::min(text.find('/'), text.size());
+            segment seg;
+            for (std::size_t i = 0; i < size; ++i) {
+                if (text[i] != '~') {
+                    seg.key += text[i];
+                } else if (i + 1 < size && (text[i + 1] == '0' || text[i + 1] == '1')) {
+                    seg.key += text[++i] == '0' ? '~' : '/';
+                } else {
+                    raise(parse_error { "Invalid escape in JSON pointer: " + std::string { pointer_text } });
+                }
+            }
+            seg.wildcard = seg.key == "*";
+            // Array index is decimal without leading zeros
+            std::size_t index = 0;
+            const auto* last = seg.key.data() + seg.key.size();
+            const auto [ptr, ec] = std::from_chars(seg.key.data(), last, index);
+            if (ec == std::errc {} && ptr == last && (seg.key.size() == 1 || seg.key.front() != '0')) {
+                seg.index = index;
+            }
+            result.push_back(std::move(seg));
+            text.remove_prefix(size);
+        }
+        return result;
+    }
+
+    // Matches value at the depth against pointers still active on its path
+    template <typename Callback>
+    void select_in(json& value, std::size_t depth, const std::vector<std::size_t>& active, Callback& on_match) const
+    {
+        if (std::ranges::any_of(active, [&](auto i) { return pointers_[i].size() == depth; })) {
+            on_match(value);
+            return;
+        }
+        std::vector<std::size_t> matching;
+        const auto select_child = [&](auto& stream, const auto& key) {
+            // Key view dies with the next token, so match before reading the value
+            matching.clear();
+            std::ranges::copy_if(active, std::back_inserter(matching), [&](auto i) { return pointers_[i][depth].matches(key); });
+            if (matching.empty()) {
+                stream.skip_value();
+            } else {
+                auto child = stream.read_value();
+                select_in(child, depth + 1, matching, on_match);
+            }
+        };
+        if (auto* object = std::get_if<object_stream>(&value)) {
+            while (auto key = object->next_key()) {
+                select_child(*object, *key);
+            }
+        } else if (auto* array = std::get_if<array_stream>(&value)) {
+            for (std::size_t index = 0; array->next_element(); ++index) {
+                select_child(*array, index);
+            }
+        }
+    }
+
+    std::vector<pointer> pointers_;
+};
+
+// Random access tree materialized from a stream into a monotonic arena.
+// Nodes are compact tagged values, children of a container are stored contiguously
+// and object keys are interned, so building makes few allocations and the whole
+// document is released at once without visiting nodes.
+class document {
+public:
+    enum class node_type : uint8_t {
+        INTEGER,
+        DOUBLE,
+        STRING,
+        OBJECT,
+        ARRAY,
+    };
+
+    class node {
+    public:
+        [[nodiscard]] node_type type() const noexcept
+        {
+            return type_;
+        }
+
+        [[nodiscard]] int64_t as_integer() const noexcept
+        {
+            assert(type_ == node_type::INTEGER);
+            return integer_;
+        }
+
+        [[nodiscard]] double as_double() const noexcept
+        {
+            assert(type_ == node_type::DOUBLE);
+            return number_;
+        }
+
+        [[nodiscard]] std::string_view as_string() const noexcept
+        {
+            assert(type_ == node_type::STRING);
+            return { string_, size_ };
+        }
+
+        // Number of array elements or object members
+        [[nodiscard]] std::size_t size() const noexcept
+        {
+            assert(type_ == node_type::OBJECT || type_ == node_type::ARRAY);
+            return size_;
+        }
+
+        [[nodiscard]] const node& operator[](std::size_t index) const noexcept
+        {
+            assert(type_ == node_type::ARRAY && index < size_);
+            return children_[index];
+        }
+
+        // Object members are stored as key node followed by value node
+        [[nodiscard]] std::string_view key(std::size_t index) const noexcept
+        {
+            assert(type_ == node_type::OBJECT && index < size_);
+            return children_[2 * index].as_string();
+        }
+
+        [[nodiscard]] const node& value(std::size_t index) const noexcept
+        {
+            assert(type_ == node_type::OBJECT && index < size_);
+            return children_[2 * index + 1];
+        }
+
+        // Value of the first member with the key, nullptr if there is none
+        [[nodiscard]] const node* find(std::string_view key) const noexcept
+        {
+            for (std::size_t i = 0; i < size(); ++i) {
+                if (this->key(i) == key) {
+                    return &value(i);
+                }
+            }
+            return nullptr;
+        }
+
+    private:
+        friend class document;
+
+        union {
+            int64_t integer_ = 0;
+            double number_;
+            const char* string_;
+            const node* children_;
+        };
+        // String length, array elements or object members count
+        uint32_t size_ = 0;
+        node_type type_ = node_type::INTEGER;
+    };
+
+    // Drains the value into the arena
+    explicit document(json& value, std::size_t initial_size = default_chunk_size)
+        : arena_ { std::make_unique<std::pmr::monotonic_buffer_resource>(initial_size) }
+    {
+        build(value);
+    }
+
+    [[nodiscard]] const node& root() const noexcept
+    {
+        return root_;
+    }
+
+private:
+    static node make_node(node_type type, const void* data, std::size_t size)
+    {
+        if (size > std::numeric_limits<uint32_t>::max()) {
+            raise(parse_error { "Value is too large for document" });
+        }
+        node result;
+        result.type_ = type;
+        result.size_ = static_cast<uint32_t>(size);
+        if (type == node_type::STRING) {
+            result.string_ = static_cast<const char*>(data);
+        } else {
+            result.children_ = static_cast<const node*>(data);
+        }
+        return result;
+    }
+
+    std::string_view copy_string(std::string_view str)
+    {
+        auto* data = static_cast<char*>(arena_->allocate(str.size(), alignof(char)));
+        std::memcpy(data, str.data(), str.size());
+        return { data, str.size() };
+    }
+
+    // Children of open containers are collected on the scratch stack and moved
+    // to the arena in one piece when the container ends
+    void build(json& value)
+    {
+        struct open_container {
+            json stream;
+            std::size_t first_child;
+        };
+        std::vector<open_container> stack;
+        std::vector<node> scratch;
+        std::unordered_set<std::string_view> keys;
+        std::optional<json> child;
+        const auto add = [&](auto&& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, object_stream> || std::is_same_v<T, array_stream>) {
+                child.emplace(std::move(v));
+            } else if constexpr (std::is_same_v<T, int64_t>) {
+                scratch.emplace_back().integer_ = v;
+            } else if constexpr (std::is_same_v<T, double>) {
+                auto& number = scratch.emplace_back();
+                number.type_ = node_type::DOUBLE;
+                number.number_ = v;
+            } else {
+                const auto str = copy_string(v);
+                scratch.push_back(make_node(node_type::STRING, str.data(), str.size()));
+            }
+        };
+        std::visit(add, value);
+        while (child || !stack.empty()) {
+            if (child) {
+                stack.push_back({ std::move(*child), scratch.size() });
+                child.reset();
+            }
+            auto& top = stack.back();
+            if (auto* object = std::get_if<object_stream>(&top.stream)) {
+                if (auto key = object->next_key()) {
+                    auto interned = keys.find(*key);
+                    if (interned == keys.end()) {
+                        interned = keys.insert(copy_string(*key)).first;
+                    }
+                    scratch.push_back(make_node(node_type::STRING, interned->data(), interned->size()));
+                    object->visit_value(add);
+                    continue;
+                }
+            } else if (auto* array = std::get_if<array_stream>(&top.stream)) {
+                if (array->next_element()) {
+                    array->visit_value(add);
+                    continue;
+                }
+            }
+            const auto count = scratch.size() - top.first_child;
+            auto* children = static_cast<node*>(arena_->allocate(count * sizeof(node), alignof(node)));
+            std::uninitialized_copy(scratch.begin() + top.first_child, scratch.end(), children);
+            const bool is_object = std::holds_alternative<object_stream>(top.stream);
+            scratch.resize(top.first_child);
+            stack.pop_back();
+            scratch.push_back(make_node(is_object ? node_type::OBJECT : node_type::ARRAY, children, is_object ? count / 2 : count));
+        }
+        root_ = scratch.back();
+    }
+
+    // Arena is kept by pointer, so nodes stay in place when document is moved
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_;
+    node root_;
+};
+
+// Flat representation of a parsed value, one pass over the entries visits the whole value.
+// Entry keeps lexer::token_type in the top byte and payload in the rest:
+// container begin and end point to each other, so subtree is skipped in O(1);
+// string entry is followed by its length and number entry by its raw value.
+class tape {
+public:
+    using entry = uint64_t;
+
+    // Drains the value into the tape
+    explicit tape(json& value)
+    {
+        build(value);
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return entries_.size();
+    }
+
+    [[nodiscard]] lexer::token_type type(std::size_t index) const noexcept
+    {
+        return static_cast<lexer::token_type>(entries_[index] >> payload_bits);
+    }
+
+    // Index of the value following the one at index
+    [[nodiscard]] std::size_t next(std::size_t index) const noexcept
+    {
+        switch (type(index)) {
+        case lexer::token_type::OBJECT_BEGIN:
+        case lexer::token_type::ARRAY_BEGIN:
+            return payload(index) + 1;
+        case lexer::token_type::STRING:
+        case lexer::token_type::NUMBER:
+            return index + 2;
+        default:
+            return index + 1;
+        }
+    }
+
+    // Index of END entry of the container
+    [[nodiscard]] std::size_t end(std::size_t index) const noexcept
+    {
+        assert(type(index) == lexer::token_type::OBJECT_BEGIN || type(index) == lexer::token_type::ARRAY_BEGIN);
+        return payload(index);
+    }
+
+    [[nodiscard]] bool is_integer(std::size_t index) const noexcept
+    {
+        assert(type(index) == lexer::token_type::NUMBER);
+        return payload(index) == integer_number;
+    }
+
+    [[nodiscard]] int64_t as_integer(std::size_t index) const noexcept
+    {
+        assert(is_integer(index));
+        return static_cast<int64_t>(entries_[index + 1]);
+    }
+
+    [[nodiscard]] double as_double(std::size_t index) const noexcept
+    {
+        assert(!is_integer(index));
+        return std::bit_cast<double>(entries_[index + 1]);
+    }
+
+    [[nodiscard]] std::string_view as_string(std::size_t index) const noexcept
+    {
+        assert(type(index) == lexer::token_type::STRING);
+        return std::string_view { strings_ }.substr(payload(index), entries_[index + 1]);
+    }
+
+private:
+    static constexpr int payload_bits = 56;
+    static constexpr entry integer_number = 0;
+    static constexpr entry double_number = 1;
+
+    [[nodiscard]] entry payload(std::size_t index) const noexcept
+    {
+        return entries_[index] & ((entry { 1 } << payload_bits) - 1);
+    }
+
+    void push(lexer::token_type type, entry payload)
+    {
+        entries_.push_back(static_cast<entry>(type) << payload_bits | payload);
+    }
+
+    void push_string(std::string_view str)
+    {
+        push(lexer::token_type::STRING, strings_.size());
+        entries_.push_back(str.size());
+        strings_.append(str);
+    }
+
+    void build(json& value)
+    {
+        // Open streams with index of their BEGIN entry, patched when the stream ends
+        std::vector<std::pair<json, std::size_t>> stack;
+        std::optional<json> child;
+        const auto add = [&](auto&& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, object_stream> || std::is_same_v<T, array_stream>) {
+                child.emplace(std::move(v));
+            } else if constexpr (std::is_same_v<T, int64_t>) {
+                push(lexer::token_type::NUMBER, integer_number);
+                entries_.push_back(static_cast<entry>(v));
+            } else if constexpr (std::is_same_v<T, double>) {
+                push(lexer::token_type::NUMBER, double_number);
+                entries_.push_back(std::bit_cast<entry>(v));
+            } else {
+                push_string(v);
+            }
+        };
+        std::visit(add, value);
+        while (child || !stack.empty()) {
+            if (child) {
+                const auto begin = entries_.size();
+                push(std::holds_alternative<object_stream>(*child) ? lexer::token_type::OBJECT_BEGIN : lexer::token_type::ARRAY_BEGIN, 0);
+                stack.emplace_back(std::move(*child), begin);
+                child.reset();
+            }
+            auto& [stream, begin] = stack.back();
+            if (auto* object = std::get_if<object_stream>(&stream)) {
+                if (auto key = object->next_key()) {
+                    push_string(*key);
+                    object->visit_value(add);
+                    continue;
+                }
+            } else if (auto* array = std::get_if<array_stream>(&stream)) {
+                if (array->next_element()) {
+                    array->visit_value(add);
+                    continue;
+                }
+            }
+            const bool is_object = std::holds_alternative<object_stream>(stream);
+            entries_[begin] |= entries_.size();
+            push(is_object ? lexer::token_type::OBJECT_END : lexer::token_type::ARRAY_END, begin);
+            stack.pop_back();
+        }
+    }
+
+    std::vector<entry> entries_;
+    std::string strings_;
+};
+
+// Struct members bound to object keys, specialized by JSON_FIELDS(T, members...)
+template <typename T>
+struct fields;
+
+template <typename T, typename = void>
+struct has_fields : std::false_type { };
+
+template <typename T>
+struct has_fields<T, std::void_t<decltype(fields<T>::members)>> : std::true_type { };
+
+template <typename T, typename M>
+struct field {
+    std::string_view name;
+    M T::*member;
+};
+
+template <typename T, typename M>
+constexpr field<T, M> make_field(std::string_view name, M T::*member)
+{
+    return { name, member };
+}
+
+// Perfect hash of field names found at compile time: seeded FNV-1a hash is tried with growing seeds
+// until every name gets its own slot, so lookup is one hash and at most one comparison.
+template <std::size_t N>
+class key_table {
+public:
+    static constexpr std::size_t npos = N;
+
+    constexpr explicit key_table(const std::array<std::string_view, N>& names)
+    {
+        for (;; ++seed_) {
+            if (seed_ == max_seed) {
+                raise(parse_error { "Field names have no perfect hash, duplicate names?" });
+            }
+            if (try_seed(names)) {
+                return;
+            }
+        }
+    }
+
+    // Index of the field named by key, npos for unknown keys
+    [[nodiscard]] constexpr std::size_t find(std::string_view key) const
+    {
+        const auto slot = hash(key, seed_) & (slots - 1);
+        return index_[slot] != npos && names_[slot] == key ? index_[slot] : npos;
+    }
+
+private:
+    // Sparse table keeps expected number of tried seeds small
+    static constexpr std::size_t slots = [] {
+        std::size_t size = 1;
+        while (size < 4 * N) {
+            size *= 2;
+        }
+        return size;
+    }();
+    static constexpr uint32_t max_seed = 1 << 16;
+
+    // Seed is mixed into the FNV-1a basis, so every seed gives another hash of the same names
+    [[nodiscard]] static constexpr uint32_t hash(std::string_view key, uint32_t seed)
+    {
+        return fnv1a(key, 2166136261u ^ seed);
+    }
+
+    constexpr bool try_seed(const std::array<std::string_view, N>& names)
+    {
+        for (std::size_t slot = 0; slot < slots; ++slot) {
+            names_[slot] = {};
+            index_[slot] = npos;
+        }
+        for (std::size_t i = 0; i < N; ++i) {
+            const auto slot = hash(names[i], seed_) & (slots - 1);
+            if (index_[slot] != npos) {
+                return false;
+            }
+            names_[slot] = names[i];
+            index_[slot] = i;
+        }
+        return true;
+    }
+
+    uint32_t seed_ = 0;
+    std::array<std::string_view, slots> names_ {};
+    std::array<std::size_t, slots> index_ {};
+};
+
+template <typename T>
+struct is_vector : std::false_type { };
+
+template <typename T, typename Allocator>
+struct is_vector<std::vector<T, Allocator>> : std::true_type { };
+
+template <typename T>
+struct is_optional : std::false_type { };
+
+template <typename T>
+struct is_optional<std::optional<T>> : std::true_type { };
+
+template <typename T>
+void bind(object_stream& object, T& out);
+
+template <typename Stream, typename M>
+void read_member(Stream& stream, M& member, std::string_view name);
+
+// Scalars are taken from lexer tokens as is, containers are read from their streams
+template <typename M, typename V>
+void assign_member(M& member, V&& value, std::string_view name)
+{
+    using T = std::decay_t<V>;
+    if constexpr (is_optional<M>::value) {
+        assign_member(member.emplace(), std::forward<V>(value), name);
+    } else if constexpr (std::is_same_v<M, std::string> && std::is_same_v<T, std::string_view>) {
+        member.assign(value);
+    } else if constexpr (std::is_floating_point_v<M> && (std::is_same_v<T, int64_t> || std::is_same_v<T, double>)) {
+        member = static_cast<M>(value);
+    } else if constexpr (std::is_integral_v<M> && !std::is_same_v<M, bool> && std::is_same_v<T, int64_t>) {
+        // Integers are not narrowed, no integer is taken for bool
+        if (!std::in_range<M>(value)) {
+            raise(parse_error { "Value out of range of field: " + std::string(name) });
+        }
+        member = static_cast<M>(value);
+    } else if constexpr (has_fields<M>::value && std::is_same_v<T, object_stream>) {
+        bind(value, member);
+    } else if constexpr (is_vector<M>::value && std::is_same_v<T, array_stream>) {
+        while (value.next_element()) {
+            read_member(value, member.emplace_back(), name);
+        }
+    } else {
+        raise(parse_error { "Unexpected type of field: " + std::string(name) });
+    }
+}
+
+template <typename Stream, typename M>
+void read_member(Stream& stream, M& member, std::string_view name)
+{
+    stream.visit_value([&](auto&& value) { assign_member(member, std::forward<decltype(value)>(value), name); });
+}
+
+template <typename T, typename Members, std::size_t... I>
+void read_field(object_stream& object, T& out, const Members& members, std::size_t index, std::index_sequence<I...>)
+{
+    ((index == I ? read_member(object, out.*std::get<I>(members).member, std::get<I>(members).name) : void()), ...);
+}
+
+// Read object pairs straight into members described by JSON_FIELDS.
+// Keys are matched as lexer views, values of unknown keys are skipped without tokenization.
+template <typename T>
+void bind(object_stream& object, T& out)
+{
+    static_assert(has_fields<T>::value, "Members are described by JSON_FIELDS(T, members...)");
+    constexpr auto& members = fields<T>::members;
+    constexpr auto size = std::tuple_size_v<std::decay_t<decltype(members)>>;
+    static constexpr key_table<size> keys { std::apply([](const auto&... field) { return std::array<std::string_view, size> { field.name... }; }, members) };
+    while (const auto key = object.next_key()) {
+        if (const auto index = keys.find(*key); index != keys.npos) {
+            read_field(object, out, members, index, std::make_index_sequence<size> {});
+        } else {
+            object.skip_value();
+        }
+    }
+}
+
+template <typename T>
+T bind(json& value)
+{
+    auto* object = std::get_if<object_stream>(&value);
+    if (!object) {
+        raise(parse_error { "Expected object" });
+    }
+    T out {};
+    bind(*object, out);
+    return out;
+}
+
+// Main parsing function
+json parse(std::unique_ptr<source> src)
+{
+    auto context = std::make_unique<parser>(std::move(src));
+    // Root stream owns the context, nested streams borrow its lexer
+    return parse_value(lexer_ref { context->lexer_, std::move(context) });
+}
+
+// Compatibility overload, prefer sources reading input by chunks
+json parse(std::istreambuf_iterator<char>&& input)
+{
+    return parse(std::make_unique<istreambuf_source>(std::move(input)));
+}
+
+// Parse contiguous input in place, input must outlive parsing
+json parse(std::string_view input)
+{
+    return parse(std::make_unique<memory_source>(input));
+}
+
+// Parse memory-mapped file
+json parse_file(const std::string& path)
+{
+    return parse(std::make_unique<mapped_file_source>(path));
+}
+
+// Parse value into a tape
+tape parse_tape(std::unique_ptr<source> src)
+{
+    parser context { std::move(src) };
+    auto value = context.parse();
+    return tape { value };
+}
+
+} // namespace json
+
+// Describes bound members of T for json::bind(), up to 16 members:
+// struct point { int64_t x; int64_t y; };
+// JSON_FIELDS(point, x, y)
+#define JSON_FIELDS(T, ...) \
+    template <> \
+    struct json::fields<T> { \
+        static constexpr auto members = std::make_tuple(JSON_FIELDS_CONCAT(JSON_FIELDS_, JSON_FIELDS_COUNT(__VA_ARGS__))(T, __VA_ARGS__)); \
+    };
+
+#define JSON_FIELDS_CONCAT(a, b) JSON_FIELDS_CONCAT_IMPL(a, b)
+#define JSON_FIELDS_CONCAT_IMPL(a, b) a##b
+#define JSON_FIELDS_COUNT(...) JSON_FIELDS_COUNT_IMPL(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define JSON_FIELDS_COUNT_IMPL(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+#define JSON_FIELDS_1(T, m) ::json::make_field(#m, &T::m)
+#define JSON_FIELDS_2(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_1(T, __VA_ARGS__)
+#define JSON_FIELDS_3(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_2(T, __VA_ARGS__)
+#define JSON_FIELDS_4(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_3(T, __VA_ARGS__)
+#define JSON_FIELDS_5(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_4(T, __VA_ARGS__)
+#define JSON_FIELDS_6(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_5(T, __VA_ARGS__)
+#define JSON_FIELDS_7(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_6(T, __VA_ARGS__)
+#define JSON_FIELDS_8(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_7(T, __VA_ARGS__)
+#define JSON_FIELDS_9(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_8(T, __VA_ARGS__)
+#define JSON_FIELDS_10(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_9(T, __VA_ARGS__)
+#define JSON_FIELDS_11(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_10(T, __VA_ARGS__)
+#define JSON_FIELDS_12(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_11(T, __VA_ARGS__)
+#define JSON_FIELDS_13(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_12(T, __VA_ARGS__)
+#define JSON_FIELDS_14(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_13(T, __VA_ARGS__)
+#define JSON_FIELDS_15(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_14(T, __VA_ARGS__)
+#define JSON_FIELDS_16(T, m, ...) JSON_FIELDS_1(T, m), JSON_FIELDS_15(T, __VA_ARGS__)
+
+// Newline followed by indentation of the level, sliced from a buffer growing on demand.
+// Outgrown buffers are kept, so slices taken earlier stay valid while output is in progress.
+class indent_cache {
+public:
+    explicit indent_cache(uint16_t base)
+        : base_ { base }
+    {
+    }
+
+    [[nodiscard]] uint16_t base() const noexcept
+    {
+        return base_;
+    }
+
+    [[nodiscard]] std::string_view operator()(std::size_t level)
+    {
+        const auto size = 1 + std::size_t { base_ } * level;
+        if (buffers_.empty() || buffers_.back().size() < size) {
+            auto& buffer = buffers_.emplace_back(std::max(size, buffers_.empty() ? std::size_t { 256 } : 2 * buffers_.back().size()), ' ');
+            buffer.front() = '\n';
+        }
+        return { buffers_.back().data(), size };
+    }
+
+private:
+    uint16_t base_;
+    std::deque<std::string> buffers_;
+};
+
+// Quoted string with escaped special characters, clean runs are yielded in place.
+// Referenced data must outlive the generator.
+std::generator<std::string_view> escaped(std::string_view str)
+{
+    std::array<char, 6> buffer;
+    co_yield "\"";
+    for (;;) {
+        const char* special = json::simd::find_escape(str.data(), str.data() + str.size());
+        const auto clean = static_cast<std::size_t>(special - str.data());
+        if (clean != 0) {
+            co_yield str.substr(0, clean);
+        }
+        if (clean == str.size()) {
+            break;
+        }
+        co_yield json::escape_sequence(*special, buffer);
+        str.remove_prefix(clean + 1);
+    }
+    co_yield "\"";
+}
+
+std::generator<std::string_view> add_left(std::string_view str, std::generator<std::string_view> g)
+{
+    co_yield str;
+    co_yield std::ranges::elements_of(std::move(g));
+}
+
+// Streaming serialization outputs consumed part of JSON stream, pretty output adds indentation.
+// Yielded chunks are valid until the generator is resumed.
+template <bool Pretty>
+std::generator<std::string_view> serialize(indent_cache& indent, uint16_t level, auto& value)
+{
+    using T = std::decay_t<decltype(value)>;
+    if constexpr (std::same_as<T, json::json>) {
+        co_yield std::ranges::elements_of(std::visit([&](auto& v) { return serialize<Pretty>(indent, level, v); }, value));
+    } else if constexpr (std::same_as<T, std::string>) {
+        co_yield std::ranges::elements_of(escaped(value));
+    } else if constexpr (std::same_as<T, json::object_stream::value_type>) {
+        co_yield std::ranges::elements_of(escaped(value.first));
+        co_yield ": ";
+        co_yield std::ranges::elements_of(serialize<Pretty>(indent, level, value.second));
+    } else if constexpr (std::integral<T> || std::floating_point<T>) {
+        co_yield std::format("{}", value);
+    } else if constexpr (std::ranges::input_range<T>) {
+        constexpr auto brackets = std::same_as<T, json::object_stream> ? std::make_pair("{", "}") : std::make_pair("[", "]");
+        auto items = value
+            // transform key-value pair to lazy strings representation
+            | std::views::transform([&indent, level](auto& v) {
+                  if constexpr (Pretty) {
+                      // add indentation before key
+                      return add_left(indent(level + 1), serialize<Pretty>(indent, level + 1, v));
+                  } else {
+                      return serialize<Pretty>(indent, level + 1, v);
+                  }
+              })
+            // add ',' between items
+            | std::views::join_with(std::string_view { "," });
+
+        co_yield brackets.first;
+        for (auto item : items)
+            co_yield item;
+        if constexpr (Pretty) {
+            co_yield indent(level);
+        }
+        co_yield brackets.second;
+    }
+}
+
+// Zero indentation base selects compact output without any indentation logic
+std::generator<std::string_view> serialize(indent_cache& indent, json::json& value)
+{
+    return indent.base() == 0 ? serialize<false>(indent, 0, value) : serialize<true>(indent, 0, value);
+}
+
+// Non-recursive formatter producing the same output as serialize().
+// Nesting is kept in an explicit stack of streams instead of native stack or coroutine frames,
+// and scalars are written straight from lexer tokens, so formatting allocates nothing per node.
+// With raw scalars, strings and numbers of streams are copied from the input as they were written,
+// without decoding, conversion and re-encoding. Keys and materialized values are formatted as usual.
+class formatter {
+public:
+    // Deeper documents are rejected to keep memory bounded on adversarial input
+    static constexpr std::size_t default_max_depth = std::size_t { 1 } << 20;
+
+    explicit formatter(uint16_t indent_base, std::size_t max_depth = default_max_depth, bool raw_scalars = false)
+        : indent_ { indent_base }
+        , max_depth_ { max_depth }
+        , raw_scalars_ { raw_scalars }
+    {
+        stack_.reserve(std::min(max_depth_, std::size_t { 256 }));
+    }
+
+    // Consumes the value, stack storage is reused for the next one
+    void format(json::sink& out, json::json& value)
+    {
+        // Zero indentation base selects compact output without any indentation logic
+        if (indent_.base() == 0) {
+            format<false>(out, value);
+        } else {
+            format<true>(out, value);
+        }
+    }
 
-// Main parsing function
-json parse(std::istreambuf_iterator<char>&& input)
+    // Formats materialized document the same way as the stream it was built from
+    void format(json::sink& out, const json::document& document)
+    {
+        if (indent_.base() == 0) {
+            format<false>(out, document.root());
+        } else {
+            format<true>(out, document.root());
+        }
+    }
+
+    // Formats tape in one linear pass
+    void format(json::sink& out, const json::tape& tape)
+    {
+        if (indent_.base() == 0) {
+            format<false>(out, tape);
+        } else {
+            format<true>(out, tape);
+        }
+    }
+
+private:
+    struct frame {
+        json::json value;
+        bool first = true;
+    };
+
+    template <bool Pretty>
+    void format(json::sink& out, json::json& value)
+    {
+        // Streams left on the stack by an exception must not outlive their parser
+        struct clear_on_exit {
+            std::vector<frame>& stack;
+            ~clear_on_exit() { stack.clear(); }
+        } clear { stack_ };
+        std::optional<json::json> child;
+        // Scalars are written at once, containers are pushed after the visit
+        const auto write_value = [&](auto&& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, json::object_stream> || std::is_same_v<T, json::array_stream>) {
+                child.emplace(std::move(v));
+            } else if constexpr (std::is_same_v<T, json::raw_scalar>) {
+                out.append(v.bytes);
+            } else if constexpr (std::is_arithmetic_v<T>) {
+                write_number(out, v);
+            } else {
+                write_string(out, v);
+            }
+        };
+        std::visit(write_value, value);
+        while (child || !stack_.empty()) {
+            if (child) {
+                push(out, std::move(*child));
+                child.reset();
+            }
+            auto& top = stack_.back();
+            if (auto* object = std::get_if<json::object_stream>(&top.value)) {
+                if (auto key = object->next_key()) {
+                    separate<Pretty>(out, top);
+                    write_key(out, *key);
+                    if (raw_scalars_) {
+                        object->visit_raw_value(write_value);
+                    } else {
+                        object->visit_value(write_value);
+                    }
+                    continue;
+                }
+            } else if (auto* array = std::get_if<json::array_stream>(&top.value)) {
+                if (array->next_element()) {
+                    separate<Pretty>(out, top);
+                    if (raw_scalars_) {
+                        array->visit_raw_value(write_value);
+                    } else {
+                        array->visit_value(write_value);
+                    }
+                    continue;
+                }
+            }
+            if constexpr (Pretty) {
+                out.append(indent_(stack_.size() - 1));
+            }
+            out.append(std::holds_alternative<json::object_stream>(top.value) ? '}' : ']');
+            stack_.pop_back();
+        }
+    }
+
+    template <bool Pretty>
+    void format(json::sink& out, const json::document::node& root)
+    {
+        using node_type = json::document::node_type;
+        // Open containers with index of their next child
+        positions_.clear();
+        const auto write_node = [&](const json::document::node& node) {
+            switch (node.type()) {
+            case node_type::INTEGER:
+                write_number(out, node.as_integer());
+                break;
+            case node_type::DOUBLE:
+                write_number(out, node.as_double());
+                break;
+            case node_type::STRING:
+                write_string(out, node.as_string());
+                break;
+            case node_type::OBJECT:
+            case node_type::ARRAY:
+                out.append(node.type() == node_type::OBJECT ? '{' : '[');
+                positions_.emplace_back(&node, 0);
+                break;
+            }
+        };
+        write_node(root);
+        while (!positions_.empty()) {
+            const auto [container, index] = positions_.back();
+            if (index < container->size()) {
+                ++positions_.back().second;
+                if (index != 0) {
+                    out.append(',');
+                }
+                if constexpr (Pretty) {
+                    out.append(indent_(positions_.size()));
+                }
+                if (container->type() == node_type::OBJECT) {
+                    write_key(out, container->key(index));
+                    write_node(container->value(index));
+                } else {
+                    write_node((*container)[index]);
+                }
+                continue;
+            }
+            if constexpr (Pretty) {
+                out.append(indent_(positions_.size() - 1));
+            }
+            out.append(container->type() == node_type::OBJECT ? '}' : ']');
+            positions_.pop_back();
+        }
+    }
+
+    template <bool Pretty>
+    void format(json::sink& out, const json::tape& tape)
+    {
+        using token_type = json::lexer::token_type;
+        // Open containers: whether it is an object and whether any member was written
+        levels_.clear();
+        for (std::size_t i = 0; i < tape.size();) {
+            auto type = tape.type(i);
+            if (type == token_type::OBJECT_END || type == token_type::ARRAY_END) {
+                levels_.pop_back();
+                if constexpr (Pretty) {
+                    out.append(indent_(levels_.size()));
+                }
+                out.append(type == token_type::OBJECT_END ? '}' : ']');
+                ++i;
+                continue;
+            }
+            if (!levels_.empty()) {
+                auto& [is_object, first] = levels_.back();
+                if (!std::exchange(first, false)) {
+                    out.append(',');
+                }
+                if constexpr (Pretty) {
+                    out.append(indent_(levels_.size()));
+                }
+                // Member key is the string entry before the value
+                if (is_object) {
+                    write_key(out, tape.as_string(i));
+                    i = tape.next(i);
+                    type = tape.type(i);
+                }
+            }
+            switch (type) {
+            case token_type::NUMBER:
+                if (tape.is_integer(i)) {
+                    write_number(out, tape.as_integer(i));
+                } else {
+                    write_number(out, tape.as_double(i));
+                }
+                break;
+            case token_type::STRING:
+                write_string(out, tape.as_string(i));
+                break;
+            default:
+                out.append(type == token_type::OBJECT_BEGIN ? '{' : '[');
+                levels_.emplace_back(type == token_type::OBJECT_BEGIN, true);
+                ++i;
+                continue;
+            }
+            i = tape.next(i);
+        }
+    }
+
+    void push(json::sink& out, json::json&& stream)
+    {
+        if (stack_.size() == max_depth_) {
+            json::raise(json::parse_error { "Maximum nesting depth exceeded" });
+        }
+        out.append(std::holds_alternative<json::object_stream>(stream) ? '{' : '[');
+        stack_.push_back(frame { std::move(stream) });
+    }
+
+    template <bool Pretty>
+    void separate(json::sink& out, frame& top)
+    {
+        if (!std::exchange(top.first, false)) {
+            out.append(',');
+        }
+        if constexpr (Pretty) {
+            out.append(indent_(stack_.size()));
+        }
+    }
+
+    static void write_key(json::sink& out, std::string_view key)
+    {
+        json::append_quoted(out, key);
+        out.append(": ");
+    }
+
+    static void write_string(json::sink& out, std::string_view str)
+    {
+        json::append_quoted(out, str);
+    }
+
+    // Shortest representation, same as std::format("{}")
+    template <typename T>
+    static void write_number(json::sink& out, T number)
+    {
+        char buffer[32];
+        const auto result = std::to_chars(std::begin(buffer), std::end(buffer), number);
+        out.append({ buffer, static_cast<std::size_t>(result.ptr - buffer) });
+    }
+
+    indent_cache indent_;
+    std::size_t max_depth_;
+    bool raw_scalars_;
+    std::vector<frame> stack_;
+    std::vector<std::pair<const json::document::node*, std::size_t>> positions_;
+    std::vector<std::pair<bool, bool>> levels_;
+};
+
+// Writes head byte followed by low `size` bytes of the value in network byte order
+void append_big_endian(json::sink& out, uint8_t head, uint64_t value, std::size_t size)
+{
+    char bytes[9] { static_cast<char>(head) };
+    for (auto i = size; i != 0; --i, value >>= 8) {
+        bytes[i] = static_cast<char>(value & 0xff);
+    }
+    out.append({ bytes, size + 1 });
+}
+
+// Binary encodings keep doubles exactly representable as float in 4 bytes
+bool fits_float(double value)
 {
-    return parse_value(std::make_shared<lexer>(std::move(input)));
+    return std::abs(value) <= FLT_MAX && static_cast<double>(static_cast<float>(value)) == value;
 }
 
-} // namespace json
+// CBOR (RFC 8949) data items with the shortest argument encoding
+struct cbor_encoding {
+    // Indefinite-length containers are closed by the break byte
+    static constexpr char begin_array = '\x9f';
+    static constexpr char begin_map = '\xbf';
+    static constexpr char end = '\xff';
+
+    static void head(json::sink& out, uint8_t major, uint64_t argument)
+    {
+        const auto type = static_cast<uint8_t>(major << 5);
+        if (argument < 24) {
+            out.append(static_cast<char>(type | argument));
+        } else if (argument <= 0xff) {
+            append_big_endian(out, type | 24, argument, 1);
+        } else if (argument <= 0xffff) {
+            append_big_endian(out, type | 25, argument, 2);
+        } else if (argument <= 0xffffffff) {
+            append_big_endian(out, type | 26, argument, 4);
+        } else {
+            append_big_endian(out, type | 27, argument, 8);
+        }
+    }
+
+    // Negative integer -1 - n is encoded as n
+    static void integer(json::sink& out, int64_t value)
+    {
+        if (value < 0) {
+            head(out, 1, ~static_cast<uint64_t>(value));
+        } else {
+            head(out, 0, static_cast<uint64_t>(value));
+        }
+    }
+
+    static void number(json::sink& out, double value)
+    {
+        if (fits_float(value)) {
+            append_big_endian(out, 0xfa, std::bit_cast<uint32_t>(static_cast<float>(value)), 4);
+        } else {
+            append_big_endian(out, 0xfb, std::bit_cast<uint64_t>(value), 8);
+        }
+    }
+
+    static void string(json::sink& out, std::string_view str)
+    {
+        head(out, 3, str.size());
+        out.append(str);
+    }
+
+    static void array(json::sink& out, std::size_t size)
+    {
+        head(out, 4, size);
+    }
+
+    static void map(json::sink& out, std::size_t size)
+    {
+        head(out, 5, size);
+    }
+};
+
+// MessagePack values in the smallest format fitting them
+struct msgpack_encoding {
+    static void integer(json::sink& out, int64_t value)
+    {
+        // Positive and negative fixint are the value byte itself
+        if (value >= -32 && value < 128) {
+            out.append(static_cast<char>(value));
+            return;
+        }
+        const auto bits = static_cast<uint64_t>(value);
+        if (value > 0) {
+            if (bits <= 0xff) {
+                append_big_endian(out, 0xcc, bits, 1);
+            } else if (bits <= 0xffff) {
+                append_big_endian(out, 0xcd, bits, 2);
+            } else if (bits <= 0xffffffff) {
+                append_big_endian(out, 0xce, bits, 4);
+            } else {
+                append_big_endian(out, 0xcf, bits, 8);
+            }
+        } else if (value >= INT8_MIN) {
+            append_big_endian(out, 0xd0, bits, 1);
+        } else if (value >= INT16_MIN) {
+            append_big_endian(out, 0xd1, bits, 2);
+        } else if (value >= INT32_MIN) {
+            append_big_endian(out, 0xd2, bits, 4);
+        } else {
+            append_big_endian(out, 0xd3, bits, 8);
+        }
+    }
+
+    static void number(json::sink& out, double value)
+    {
+        if (fits_float(value)) {
+            append_big_endian(out, 0xca, std::bit_cast<uint32_t>(static_cast<float>(value)), 4);
+        } else {
+            append_big_endian(out, 0xcb, std::bit_cast<uint64_t>(value), 8);
+        }
+    }
+
+    static void string(json::sink& out, std::string_view str)
+    {
+        if (str.size() < 32) {
+            out.append(static_cast<char>(0xa0 | str.size()));
+        } else if (str.size() <= 0xff) {
+            append_big_endian(out, 0xd9, str.size(), 1);
+        } else if (str.size() <= 0xffff) {
+            append_big_endian(out, 0xda, str.size(), 2);
+        } else if (str.size() <= 0xffffffff) {
+            append_big_endian(out, 0xdb, str.size(), 4);
+        } else {
+            json::raise(json::parse_error { "String is too long for MessagePack" });
+        }
+        out.append(str);
+    }
+
+    static void array(json::sink& out, std::size_t size)
+    {
+        container(out, size, 0x90, 0xdc);
+    }
+
+    static void map(json::sink& out, std::size_t size)
+    {
+        container(out, size, 0x80, 0xde);
+    }
+
+    // Fixed format for up to 15 entries, then 16 and 32 bit sizes
+    static void container(json::sink& out, std::size_t size, uint8_t fixed, uint8_t sized)
+    {
+        if (size < 16) {
+            out.append(static_cast<char>(fixed | size));
+        } else if (size <= 0xffff) {
+            append_big_endian(out, sized, size, 2);
+        } else if (size <= 0xffffffff) {
+            append_big_endian(out, sized + 1, size, 4);
+        } else {
+            json::raise(json::parse_error { "Container is too large for MessagePack" });
+        }
+    }
+};
+
+// Streams are encoded as CBOR while they are read. Containers are indefinite-length,
+// so only open streams are kept and output is written before the value ends.
+void serialize_cbor(json::sink& out, json::json& value)
+{
+    std::vector<json::json> stack;
+    std::optional<json::json> child;
+    const auto write_value = [&](auto&& v) {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, json::object_stream> || std::is_same_v<T, json::array_stream>) {
+            child.emplace(std::move(v));
+        } else if constexpr (std::is_same_v<T, int64_t>) {
+            cbor_encoding::integer(out, v);
+        } else if constexpr (std::is_same_v<T, double>) {
+            cbor_encoding::number(out, v);
+        } else {
+            cbor_encoding::string(out, v);
+        }
+    };
+    std::visit(write_value, value);
+    while (child || !stack.empty()) {
+        if (child) {
+            out.append(std::holds_alternative<json::object_stream>(*child) ? cbor_encoding::begin_map : cbor_encoding::begin_array);
+            stack.push_back(std::move(*child));
+            child.reset();
+        }
+        auto& top = stack.back();
+        if (auto* object = std::get_if<json::object_stream>(&top)) {
+            if (auto key = object->next_key()) {
+                cbor_encoding::string(out, *key);
+                object->visit_value(write_value);
+                continue;
+            }
+        } else if (auto* array = std::get_if<json::array_stream>(&top)) {
+            if (array->next_element()) {
+                array->visit_value(write_value);
+                continue;
+            }
+        }
+        out.append(cbor_encoding::end);
+        stack.pop_back();
+    }
+}
 
-std::string indent(uint16_t base, uint16_t level)
+// Tape is encoded in one linear pass with definite-length containers.
+// Container size is counted by skipping over its children, so every entry is visited twice at most.
+template <typename Encoding>
+void serialize_tape(json::sink& out, const json::tape& tape)
 {
-    return base ? "\n" + std::string(base * level, ' ') : "";
+    using token_type = json::lexer::token_type;
+    for (std::size_t i = 0; i < tape.size();) {
+        const auto type = tape.type(i);
+        if (type == token_type::OBJECT_BEGIN || type == token_type::ARRAY_BEGIN) {
+            std::size_t size = 0;
+            for (auto child = i + 1; child != tape.end(i); child = tape.next(child)) {
+                ++size;
+            }
+            // Object children are keys and values
+            if (type == token_type::OBJECT_BEGIN) {
+                Encoding::map(out, size / 2);
+            } else {
+                Encoding::array(out, size);
+            }
+            ++i;
+            continue;
+        }
+        if (type == token_type::STRING) {
+            Encoding::string(out, tape.as_string(i));
+        } else if (type == token_type::NUMBER && tape.is_integer(i)) {
+            Encoding::integer(out, tape.as_integer(i));
+        } else if (type == token_type::NUMBER) {
+            Encoding::number(out, tape.as_double(i));
+        }
+        // Container ends take no bytes, sizes are already written
+        i = tape.next(i);
+    }
 }
 
-std::generator<std::string> add_left(std::string str, std::generator<std::string> g)
+void serialize_cbor(json::sink& out, const json::tape& tape)
 {
-    co_yield str;
-    co_yield std::ranges::elements_of(std::move(g));
+    serialize_tape<cbor_encoding>(out, tape);
 }
 
-// Streaming serialization outputs consumed part of JSON stream with indentation
-std::generator<std::string> serialize(uint16_t indent_base, uint16_t level, auto& value)
+// MessagePack has no indefinite-length containers, so it is written only from a tape where sizes are known.
+// Strings and containers over 32-bit sizes cannot be encoded and raise parse_error.
+void serialize_msgpack(json::sink& out, const json::tape& tape)
 {
-    using T = std::decay_t<decltype(value)>;
-    if constexpr (std::same_as<T, json::json>) {
-        co_yield std::ranges::elements_of(std::visit([=](auto& v) { return serialize(indent_base, level, v); }, value));
-    } else if constexpr (std::same_as<T, std::string>) {
-        co_yield std::format("\"{}\"", value);
-    } else if constexpr (std::same_as<T, json::object_stream::value_type>) {
-        co_yield std::format("\"{}\": ", value.first);
-        co_yield std::ranges::elements_of(serialize(indent_base, level, value.second));
-    } else if constexpr (std::integral<T> || std::floating_point<T>) {
-        co_yield std::format("{}", value);
-    } else if constexpr (std::ranges::input_range<T>) {
-        constexpr auto brackets = std::same_as<T, json::object_stream> ? std::make_pair("{", "}") : std::make_pair("[", "]");
-        auto items = value
-            // transform key-value pair to lazy strings representation
-            | std::views::transform([=](auto& v) { return serialize(indent_base, level + 1, v); })
-            // add indentation before key
-            | std::views::transform(std::bind_front(add_left, indent(indent_base, level + 1)))
-            // add ',' between items
-            | std::views::join_with(",");
+    serialize_tape<msgpack_encoding>(out, tape);
+}
 
-        co_yield brackets.first;
-        for (auto& item : items)
-            co_yield item;
-        co_yield std::format("{}{}", indent(indent_base, level), brackets.second);
+// Formats parsing events the same way as formatter formats streams.
+// Only open containers are tracked, so output is written while the input is still arriving.
+class event_formatter {
+public:
+    event_formatter(json::sink& out, uint16_t indent_base)
+        : out_ { out }
+        , indent_ { indent_base }
+    {
+    }
+
+    void on_begin_object() { begin('{', true); }
+    void on_end_object() { end('}'); }
+    void on_begin_array() { begin('[', false); }
+    void on_end_array() { end(']'); }
+
+    void on_key(std::string_view key)
+    {
+        separate();
+        json::append_quoted(out_, key);
+        out_.append(": ");
+    }
+
+    void on_string(std::string_view str)
+    {
+        separate_element();
+        json::append_quoted(out_, str);
+    }
+
+    void on_int(int64_t number) { write_number(number); }
+    void on_double(double number) { write_number(number); }
+
+private:
+    void begin(char bracket, bool object)
+    {
+        separate_element();
+        out_.append(bracket);
+        levels_.emplace_back(object, true);
+    }
+
+    void end(char bracket)
+    {
+        levels_.pop_back();
+        if (indent_.base() != 0) {
+            out_.append(indent_(levels_.size()));
+        }
+        out_.append(bracket);
+    }
+
+    // Object members are separated before the key
+    void separate_element()
+    {
+        if (!levels_.empty() && !levels_.back().first) {
+            separate();
+        }
+    }
+
+    void separate()
+    {
+        if (!std::exchange(levels_.back().second, false)) {
+            out_.append(',');
+        }
+        if (indent_.base() != 0) {
+            out_.append(indent_(levels_.size()));
+        }
+    }
+
+    // Shortest representation, same as std::format("{}")
+    template <typename T>
+    void write_number(T number)
+    {
+        separate_element();
+        char buffer[32];
+        const auto result = std::to_chars(std::begin(buffer), std::end(buffer), number);
+        out_.append({ buffer, static_cast<std::size_t>(result.ptr - buffer) });
+    }
+
+    json::sink& out_;
+    indent_cache indent_;
+    // Open containers: whether it is an object and whether any member was written
+    std::vector<std::pair<bool, bool>> levels_;
+};
+
+// Scalars are formatted at once, streams are pushed to be read by format_async()
+void emit_async(event_formatter& events, std::vector<json::async_json>& stack, json::async_json&& value)
+{
+    if (const auto* str = std::get_if<std::string>(&value)) {
+        events.on_string(*str);
+    } else if (const auto* integer = std::get_if<int64_t>(&value)) {
+        events.on_int(*integer);
+    } else if (const auto* number = std::get_if<double>(&value)) {
+        events.on_double(*number);
+    } else {
+        if (std::holds_alternative<json::async_object_stream>(value)) {
+            events.on_begin_object();
+        } else {
+            events.on_begin_array();
+        }
+        stack.push_back(std::move(value));
+    }
+}
+
+// Replays document read through async streams as formatting events.
+// Open streams are kept on explicit stack, every await suspends until enough input is fed.
+json::async_task format_async(json::async_parser& parser, event_formatter& events)
+{
+    std::vector<json::async_json> stack;
+    emit_async(events, stack, co_await parser.root());
+    while (!stack.empty()) {
+        if (auto* object = std::get_if<json::async_object_stream>(&stack.back())) {
+            if (auto pair = co_await object->next()) {
+                events.on_key(pair->first);
+                emit_async(events, stack, std::move(pair->second));
+                continue;
+            }
+            events.on_end_object();
+        } else {
+            if (auto element = co_await std::get<json::async_array_stream>(stack.back()).next()) {
+                emit_async(events, stack, std::move(*element));
+                continue;
+            }
+            events.on_end_array();
+        }
+        stack.pop_back();
+    }
+}
+
+// Prints object keys not seen before, one per line in first-seen order.
+// Keys are interned by the parser, so repeated keys of all records are recognized by id.
+void print_new_keys(json::sink& out, json::json& value, uint32_t& printed)
+{
+    // Open containers are kept on explicit stack, scalars are skipped without materializing
+    std::vector<json::json> stack;
+    std::optional<json::json> child { std::move(value) };
+    const auto keep_container = [&](auto&& v) {
+        using type = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<type, json::object_stream> || std::is_same_v<type, json::array_stream>) {
+            child = std::move(v);
+        }
+    };
+    while (child || !stack.empty()) {
+        if (child) {
+            stack.push_back(std::move(*child));
+            child.reset();
+        }
+        auto& top = stack.back();
+        if (auto* object = std::get_if<json::object_stream>(&top)) {
+            if (const auto key = object->next_interned_key()) {
+                // Keys past the capacity of the pool cannot be recognized, so they are printed every time
+                if (key->id == printed || key->id == json::key_pool::uninterned) {
+                    if (key->id == printed) {
+                        ++printed;
+                    }
+                    json::append_quoted(out, key->text);
+                    out.append('\n');
+                }
+                object->visit_value(keep_container);
+                continue;
+            }
+        } else if (auto* array = std::get_if<json::array_stream>(&top)) {
+            if (array->next_element()) {
+                array->visit_value(keep_container);
+                continue;
+            }
+        }
+        stack.pop_back();
+    }
+}
+
+// Counters are printed to stderr as a JSON object
+void print_stats(const json::stats& counters)
+{
+    constexpr std::array<const char*, 9> token_names { "string", "number", "object_begin", "object_end", "array_begin", "array_end", "comma", "colon", "end_of_input" };
+    std::cerr << "{\"tokens\": {";
+    for (std::size_t i = 0; i < token_names.size(); ++i) {
+        std::cerr << (i ? ", \"" : "\"") << token_names[i] << "\": " << counters.tokens[i];
     }
+    std::cerr << "}, \"bytes\": " << counters.bytes << ", \"strings\": " << counters.strings << ", \"numbers\": " << counters.numbers
+              << ", \"pairs\": " << counters.pairs << ", \"elements\": " << counters.elements << ", \"max_depth\": " << counters.max_depth
+              << ", \"allocations\": " << counters.allocations << ", \"lexing_ns\": " << counters.lexing_ns
+              << ", \"serialization_ns\": " << counters.serialization_ns << "}\n";
 }
 
+// Benchmarks and harnesses include this file with their own main()
+#ifndef JSON_NO_MAIN
 int main(int argc, char** argv)
-try {
-    std::istreambuf_iterator<char> input;
-    std::istringstream iss;
+#if JSON_EXCEPTIONS
+try
+#endif
+{
     const uint16_t indent_base = (argc >= 2) ? std::stoul(argv[1]) : 0;
-    if (argc < 3) {
-        input = std::istreambuf_iterator<char> { std::cin };
-    } else if (argc == 3) {
-        iss.str(argv[2]);
-        input = std::istreambuf_iterator<char> { iss };
+    std::unique_ptr<json::source> input;
+    // File is mapped once --no-throw is known, so its open errors can be recorded
+    const char* file = nullptr;
+    std::vector<std::string> pointers;
+    bool ndjson = false;
+    bool parallel = false;
+    bool stack_formatter = false;
+    bool raw_scalars = false;
+    constexpr std::string_view output_formats[] { "json", "cbor", "msgpack" };
+    std::string_view output_format = output_formats[0];
+    bool materialize = false;
+    bool use_tape = false;
+    bool stats = false;
+    bool pipelined = false;
+    bool push = false;
+    bool sax = false;
+    bool validate = false;
+    bool async = false;
+    bool no_throw = false;
+    bool list_keys = false;
+    std::size_t fragment_size = 0;
+    json::parallel_options parallel_options;
+    for (int i = 2; i < argc; ++i) {
+        const std::string_view arg { argv[i] };
+        if (arg == "--file" && i + 1 < argc && !input && !file) {
+            file = argv[++i];
+        } else if (arg == "--query" && i + 1 < argc) {
+            pointers.emplace_back(argv[++i]);
+        } else if (arg == "--ndjson") {
+            ndjson = true;
+        } else if (arg == "--stack-formatter") {
+            stack_formatter = true;
+        } else if (arg == "--raw") {
+            raw_scalars = true;
+        } else if (arg == "--output" && i + 1 < argc && std::find(std::begin(output_formats), std::end(output_formats), argv[i + 1]) != std::end(output_formats)) {
+            output_format = argv[++i];
+        } else if (arg == "--document") {
+            materialize = true;
+        } else if (arg == "--tape") {
+            use_tape = true;
+        } else if (arg == "--pipelined") {
+            pipelined = true;
+        } else if (arg == "--validate") {
+            validate = true;
+        } else if (arg == "--no-throw") {
+            no_throw = true;
+        } else if (arg == "--keys") {
+            list_keys = true;
+        } else if (arg == "--sax") {
+            sax = true;
+        } else if (arg == "--push") {
+            push = true;
+        } else if (arg == "--async") {
+            async = true;
+        } else if (arg == "--fragment-size" && i + 1 < argc) {
+            fragment_size = std::stoul(argv[++i]);
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--parallel") {
+            parallel = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            parallel_options.threads = std::stoul(argv[++i]);
+        } else if (arg == "--chunk-size" && i + 1 < argc) {
+            parallel_options.chunk_size = std::stoul(argv[++i]);
+        } else if (!arg.starts_with("--") && !input && !file) {
+            input = std::make_unique<json::memory_source>(arg);
+        } else {
+            std::cout << "Usage:\n"
+                      << "echo '{\"key\": \"value\"}' | ./json 2\n"
+                      << "./json 2 '{\"key\": \"value\"}'\n"
+                      << "./json 2 --file data.json\n"
+                      << "./json 2 --query /key --query '/items/*/id' --file data.json\n"
+                      << "./json 2 --ndjson --file records.ndjson\n"
+                      << "./json 2 --stack-formatter --file deep.json\n"
+                      << "./json 0 --raw --file data.json\n"
+                      << "./json 0 --output cbor|msgpack [--tape] --file data.json\n"
+                      << "./json 2 --document --file data.json\n"
+                      << "./json 2 --tape --file data.json\n"
+                      << "./json 2 --stats --file data.json\n"
+                      << "cat data.json | ./json 2 --pipelined\n"
+                      << "./json 2 --sax --file data.json\n"
+                      << "./json 0 --validate --file data.json\n"
+                      << "./json 2 --no-throw --file data.json\n"
+                      << "./json 0 --keys [--ndjson] --file records.ndjson\n"
+                      << "./json 2 --push [--fragment-size 16] [--no-throw] --file data.json\n"
+                      << "./json 2 --async [--fragment-size 16] --file data.json\n"
+                      << "./json 2 --parallel [--threads 8] [--chunk-size 1048576] --file records.ndjson\n";
+            return 0;
+        }
+    }
+    // Event modes format input themselves and only --push records errors, other options would be ignored
+    const char* mode = validate ? "--validate" : sax ? "--sax" : push ? "--push" : async ? "--async" : nullptr;
+    std::string conflict;
+    if (validate + sax + push + async > 1) {
+        conflict = "Options --validate, --sax, --push and --async are exclusive";
+    } else if (mode && (ndjson || parallel || list_keys || !pointers.empty() || output_format != output_formats[0] || raw_scalars || materialize || use_tape || stack_formatter)) {
+        conflict = std::string(mode) + " does not support --ndjson, --parallel, --keys, --query, --output, --raw, --document, --tape or --stack-formatter";
+    } else if (no_throw && (ndjson || parallel || list_keys || !pointers.empty() || materialize || (mode && !push))) {
+        // JSON Pointers and documents only throw their errors
+        conflict = "--no-throw is supported only by plain parsing and --push, without --query or --document";
+    }
+    if (!conflict.empty()) {
+        std::cerr << conflict << ", see --help\n";
+        return 1;
+    }
+    if (file) {
+        input = std::make_unique<json::mapped_file_source>(file, !no_throw);
+    } else if (!input && pipelined) {
+        input = std::make_unique<json::prefetch_source>(STDIN_FILENO);
+    } else if (!input) {
+        input = std::make_unique<json::fd_source>(STDIN_FILENO);
+    }
+    if (stats && !json::stats_enabled) {
+        std::cerr << "Statistics are not compiled in, rebuild with -DJSON_STATS=1\n";
+    }
+    // Selected values are printed one per line
+    const auto print = [&](json::sink& out, json::json& value) {
+        [[maybe_unused]] std::chrono::steady_clock::time_point start;
+        [[maybe_unused]] std::size_t lexing_ns = 0;
+        if constexpr (json::stats_enabled) {
+            start = std::chrono::steady_clock::now();
+            lexing_ns = json::local_stats().lexing_ns;
+        }
+        // Formatter keeps its stack between values, parallel workers get their own
+        thread_local formatter stack_based { indent_base, formatter::default_max_depth, raw_scalars };
+        if (output_format == "cbor" && use_tape) {
+            serialize_cbor(out, json::tape { value });
+        } else if (output_format == "cbor") {
+            serialize_cbor(out, value);
+        } else if (output_format == "msgpack") {
+            serialize_msgpack(out, json::tape { value });
+        } else if (materialize) {
+            stack_based.format(out, json::document { value });
+        } else if (use_tape) {
+            stack_based.format(out, json::tape { value });
+        } else if (stack_formatter || raw_scalars) {
+            stack_based.format(out, value);
+        } else {
+            thread_local indent_cache indent { indent_base };
+            for (auto s : serialize(indent, value)) {
+                out.append(s);
+            }
+        }
+        // Binary values follow each other without separators
+        if (output_format == "json") {
+            out.append('\n');
+        }
+        if constexpr (json::stats_enabled) {
+            // Values are lexed while being serialized, lexing time is accounted separately
+            auto& counters = json::local_stats();
+            const auto elapsed = static_cast<std::size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            counters.serialization_ns += elapsed - (counters.lexing_ns - lexing_ns);
+        }
+    };
+    const json::query query { pointers };
+    const auto output = [&](json::sink& out, json::json& value) {
+        if (pointers.empty()) {
+            print(out, value);
+        } else {
+            query.select(value, [&](json::json& match) { print(out, match); });
+        }
+    };
+    // Pipelined mode reads and writes on their own threads, this one only lexes and formats
+    std::optional<json::fd_sink> direct_sink;
+    std::optional<json::async_fd_sink> async_sink;
+    json::sink& stdout_sink = pipelined ? static_cast<json::sink&>(async_sink.emplace(STDOUT_FILENO, json::default_chunk_size, 4, !no_throw)) : direct_sink.emplace(STDOUT_FILENO, json::default_chunk_size, !no_throw);
+    // Input chunks are fed to incremental parsers in fragments, as if they arrived from network
+    const auto feed_fragments = [&](auto& parser) {
+        for (auto chunk = input->next_chunk(); !chunk.empty() && !parser.last_error(); chunk = input->next_chunk()) {
+            const auto step = fragment_size ? fragment_size : chunk.size();
+            for (std::size_t i = 0; i < chunk.size(); i += step) {
+                parser.feed(chunk.substr(i, step));
+            }
+        }
+        // Read error ends the input of the lexer only, fragments are fed here, so it is passed on
+        if (const int e = input->read_error()) {
+            parser.fail_read(e);
+        } else {
+            parser.finish();
+        }
+    };
+    if (validate) {
+        // Nothing is printed for valid input, exit status tells the result
+        if (const auto result = json::validate(std::move(input)); !result) {
+            std::cerr << result.error << " at offset " << result.offset << std::endl;
+            return 1;
+        }
+    } else if (sax) {
+        // Events go from the lexer straight to the formatter
+        event_formatter events { stdout_sink, indent_base };
+        json::lexer lexer { std::move(input) };
+        json::parse_events(lexer, events);
+        stdout_sink.append('\n');
+    } else if (push) {
+        event_formatter events { stdout_sink, indent_base };
+        json::push_parser<event_formatter&> parser { events, { .throw_errors = !no_throw } };
+        feed_fragments(parser);
+        stdout_sink.append('\n');
+        if (const auto& e = parser.last_error()) {
+            stdout_sink.flush();
+            std::cerr << json::parse_error { *e }.what() << " at offset " << e->offset << std::endl;
+            return 1;
+        }
+    } else if (async) {
+        // Consumer coroutine is resumed from feed() whenever the value it awaits is complete
+        event_formatter events { stdout_sink, indent_base };
+        json::async_parser parser;
+        const auto consumer = format_async(parser, events);
+        feed_fragments(parser);
+        // Error is thrown in the consumer awaiting past it, data after the value comes when it is done
+        consumer.get();
+        if (const auto& e = parser.last_error()) {
+            json::raise(json::parse_error { *e });
+        }
+        stdout_sink.append('\n');
+    } else if (list_keys) {
+        // Records of one stream share its key pool, so every key is printed once
+        uint32_t printed = 0;
+        if (ndjson) {
+            json::ndjson_stream records { std::move(input) };
+            for (auto& record : records) {
+                print_new_keys(stdout_sink, record.value, printed);
+            }
+        } else {
+            json::parser parser { std::move(input) };
+            auto json_value = parser.parse();
+            print_new_keys(stdout_sink, json_value, printed);
+        }
+    } else if (parallel) {
+        // Chunks of records are formatted on the pool and written in input order
+        json::parallel_ndjson(
+            *input, parallel_options,
+            [&](json::ndjson_stream& records) {
+                json::string_sink out;
+                for (auto& record : records) {
+                    output(out, record.value);
+                }
+                return out.take();
+            },
+            [&](const std::string& block) { stdout_sink.append(block); });
+    } else if (ndjson) {
+        // Records are reformatted one by one
+        json::ndjson_stream records { std::move(input) };
+        for (auto& record : records) {
+            output(stdout_sink, record.value);
+        }
+    } else if (no_throw) {
+        // Streams end at the first error, which is reported after the output
+        json::parser parser { std::move(input), { .throw_errors = false } };
+        if (auto json_value = parser.try_parse()) {
+            output(stdout_sink, *json_value);
+        }
+        if (const auto& e = parser.last_error()) {
+            stdout_sink.flush();
+            std::cerr << json::parse_error { *e }.what() << " at offset " << e->offset << std::endl;
+            return 1;
+        }
     } else {
-        std::cout << "Usage:\n"
-                  << "echo '{\"key\": \"value\"}' | ./json 2\n"
-                  << "./json 2 '{\"key\": \"value\"}'\n";
-        return 0;
+        json::parser parser { std::move(input) };
+        auto json_value = parser.parse();
+        output(stdout_sink, json_value);
     }
-    auto json_value = json::parse(std::move(input));
-    for (auto s : serialize(indent_base, 0, json_value)) {
-        std::cout << s;
+    stdout_sink.flush();
+    if (async_sink) {
+        async_sink->finish();
+    }
+    // Write errors are recorded by the sinks with --no-throw
+    if (const int e = stdout_sink.write_error()) {
+        std::cerr << json::parse_error { json::error { json::error_code::WRITE_ERROR, 0, 0, e } }.what() << std::endl;
+        return 1;
+    }
+    if (stats && json::stats_enabled) {
+        print_stats(json::total_stats());
     }
-    std::cout << "\n";
     return 0;
-} catch (const json::parse_error& e) {
+}
+#if JSON_EXCEPTIONS
+catch (const json::parse_error& e) {
     std::cerr << e.what() << "\n";
     return 1;
-}
\ No newline at end of file
+}
+#endif
+#endif
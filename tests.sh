@@ -19,19 +19,171 @@ run_tests() {
     echo '[1, 2, 3]' | .bin/$bin 2 | diff - <(echo '[1, 2, 3]' | jq . --indent 2)
     echo '[-1, -2, -3]' | .bin/$bin 2 | diff - <(echo '[-1, -2, -3]' | jq . --indent 2)
     echo '[1.1, 2.2, 3.3]' | .bin/$bin 2 | diff - <(echo '[1.1, 2.2, 3.3]' | jq . --indent 2)
+    echo '[1e2, 1.5e-3, -0.25E+1, 0.001, 0]' | .bin/$bin 2 | diff - <(echo '[1e2, 1.5e-3, -0.25E+1, 0.001, 0]' | jq . --indent 2)
+    # doubles are printed in shortest form parsed back to the same value
+    echo '[0.1, 1234567.891, 1e21, 5e-324, 1.7976931348623157e308]' | .bin/$bin 2 | diff - <(echo '[0.1, 1234567.891, 1e21, 5e-324, 1.7976931348623157e308]' | jq . --indent 2)
+    # underflow is rounded to zero keeping sign, as negative zero is
+    echo '[-0, 1e-400, -0.1e-400, -0.0]' | .bin/$bin 2 | diff - <(echo '[-0, 1e-400, -0.1e-400, -0.0]' | jq . --indent 2)
     echo '["1", "2", "3"]' | .bin/$bin 2 | diff - <(echo '["1", "2", "3"]' | jq . --indent 2)
     echo '{"k": [1, 2]}' | .bin/$bin 2 | diff - <(echo '{"k": [1, 2]}' | jq . --indent 2)
+    # input larger than lexer chunk, tokens cross chunk boundaries
+    big_array="[$(seq -s ', ' 1 20000), \"$(printf 'x%.0s' $(seq 1 70000))\"]"
+    echo "$big_array" | .bin/$bin 2 | diff - <(echo "$big_array" | jq . --indent 2)
+    # input passed as argument and as memory-mapped file
+    .bin/$bin 2 '{"k": [1, "v"]}' | diff - <(echo '{"k": [1, "v"]}' | jq . --indent 2)
+    echo "$big_array" > .bin/big_array.json
+    .bin/$bin 2 --file .bin/big_array.json | diff - <(jq . --indent 2 .bin/big_array.json)
+    # escape sequences are decoded on input and produced on output, also across chunk boundaries
+    escaped='{"k\"A": ["a\\b\/c\b\f\n\r\t", "é😀", "\u001f"]}'
+    .bin/$bin 2 "$escaped" | diff - <(echo "$escaped" | jq . --indent 2)
+    .bin/$bin 2 --stack-formatter "$escaped" | diff - <(echo "$escaped" | jq . --indent 2)
+    long_escaped="[\"$(printf 'a\\n\\u00e9\\ud83d\\ude00\\"\\\\%.0s' $(seq 1 10000))\"]"
+    echo "$long_escaped" | .bin/$bin 2 | diff - <(echo "$long_escaped" | jq . --indent 2)
+    # selective extraction by JSON Pointers, other values are skipped
+    doc='{"meta": {"id": 7, "tags": ["a", "b"]}, "events": [{"ts": 1, "v": {"x": [1, "]"]}}, {"v": "}", "ts": 2}], "a/b": 3}'
+    .bin/$bin 2 --query /meta/id --query '/events/*/ts' "$doc" | diff - <(echo "$doc" | jq '.meta.id, .events[].ts' --indent 2)
+    .bin/$bin 2 --query /events/0 --query /a~1b "$doc" | diff - <(echo "$doc" | jq '.events[0], .["a/b"]' --indent 2)
+    .bin/$bin 2 --query /19999 --file .bin/big_array.json | diff - <(jq '.[19999]' .bin/big_array.json)
+    # explicit stack formatter, deep nesting would overflow recursive formatters
+    .bin/$bin 2 --stack-formatter "$doc" | diff - <(echo "$doc" | jq . --indent 2)
+    .bin/$bin 2 --stack-formatter --file .bin/big_array.json | diff - <(jq . --indent 2 .bin/big_array.json)
+    printf '[%.0s' $(seq 1 100000) > .bin/deep.json
+    printf '{"k": "v"}' >> .bin/deep.json
+    printf ']%.0s' $(seq 1 100000) >> .bin/deep.json
+    .bin/$bin 0 --stack-formatter --file .bin/deep.json | diff - <(cat .bin/deep.json; echo)
+    # raw scalars are copied from the input unchanged, also across chunk boundaries
+    raw='{"n": [1.10, -0.0, 1E+5, 12345678901234567890], "s": ["é\n", "\"", "plain"]}'
+    .bin/$bin 0 --raw "$raw" | diff - <(echo '{"n": [1.10,-0.0,1E+5,12345678901234567890],"s": ["é\n","\"","plain"]}')
+    .bin/$bin 2 --raw "$raw" | jq -c . | diff - <(echo "$raw" | jq -c .)
+    .bin/$bin 2 --raw < .bin/big_array.json | diff - <(jq . --indent 2 .bin/big_array.json)
+    echo "$long_escaped" | .bin/$bin 0 --raw | diff - <(echo "$long_escaped")
+    .bin/$bin 0 --raw --no-throw '[1.2.3]' 2>&1 | diff - <(printf '[0]\nJSON parse error: Multiple decimal points in number at offset 6\n')
+    .bin/$bin 0 --raw '["x", "ab' 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unterminated string")
+    # binary encodings: CBOR of streams has indefinite-length containers, of tapes and MessagePack definite-length ones
+    binary='{"a": [1, -1000, 1.5, 0.1, "x"], "b": {}}'
+    .bin/$bin 0 --output cbor "$binary" | od -An -tx1 | tr -d ' \n' | diff - <(printf bf61619f013903e7fa3fc00000fb3fb999999999999a6178ff6162bfffff)
+    .bin/$bin 0 --output cbor --tape "$binary" | od -An -tx1 | tr -d ' \n' | diff - <(printf a2616185013903e7fa3fc00000fb3fb999999999999a61786162a0)
+    .bin/$bin 0 --output msgpack "$binary" | od -An -tx1 | tr -d ' \n' | diff - <(printf 82a1619501d1fc18ca3fc00000cb3fb999999999999aa178a16280)
+    printf '1\n[2, "\\u00e9"]' | .bin/$bin 0 --ndjson --output msgpack | od -An -tx1 | tr -d ' \n' | diff - <(printf 019202a2c3a9)
+    # documents materialized into arena
+    .bin/$bin 2 --document "$doc" | diff - <(echo "$doc" | jq . --indent 2)
+    .bin/$bin 2 --document --file .bin/big_array.json | diff - <(jq . --indent 2 .bin/big_array.json)
+    # tape representation
+    .bin/$bin 2 --tape "$doc" | diff - <(echo "$doc" | jq . --indent 2)
+    # newline delimited records, records cross chunk boundaries
+    ndjson=$'{"id": 1, "v": [1, {"x": 2}]}\n{"id": 2}\n\n[3, "s"]\n42'
+    echo "$ndjson" | .bin/$bin 2 --ndjson | diff - <(echo "$ndjson" | jq . --indent 2)
+    seq 1 30000 | sed 's/.*/{"n": &, "v": [&]}/' > .bin/records.ndjson
+    .bin/$bin 2 --ndjson --file .bin/records.ndjson | diff - <(jq . --indent 2 .bin/records.ndjson)
+    .bin/$bin 2 --tape --ndjson --file .bin/records.ndjson | diff - <(jq . --indent 2 .bin/records.ndjson)
+    .bin/$bin 2 --ndjson --query /n < .bin/records.ndjson | diff - <(jq .n .bin/records.ndjson)
+    # parallel mode keeps records order, chunks are split in place or copied from stdin
+    .bin/$bin 2 --parallel --threads 3 --chunk-size 1000 --file .bin/records.ndjson | diff - <(jq . --indent 2 .bin/records.ndjson)
+    .bin/$bin 2 --parallel --threads 3 --chunk-size 100000 < .bin/records.ndjson | diff - <(jq . --indent 2 .bin/records.ndjson)
+    .bin/$bin 2 --parallel --threads 3 --chunk-size 1000 < .bin/records.ndjson | diff - <(jq . --indent 2 .bin/records.ndjson)
+    # pipelined mode reads and writes on their own threads
+    .bin/$bin 2 --pipelined < .bin/big_array.json | diff - <(jq . --indent 2 .bin/big_array.json)
+    .bin/$bin 2 --pipelined --ndjson < .bin/records.ndjson | diff - <(jq . --indent 2 .bin/records.ndjson)
+    # every distinct key is interned and printed once, records share one pool
+    .bin/$bin 0 --keys "$doc" | sort | diff - <(echo "$doc" | jq -r '.. | objects | keys_unsorted[] | tojson' | sort -u)
+    .bin/$bin 0 --keys --ndjson --file .bin/records.ndjson | diff - <(jq -rn '[inputs | .. | objects | keys_unsorted[]] | unique[] | tojson' .bin/records.ndjson)
+    # SAX events go from the lexer straight to the formatter
+    .bin/$bin 2 --sax "$doc" | diff - <(echo "$doc" | jq . --indent 2)
+    .bin/$bin 2 --sax < .bin/big_array.json | diff - <(jq . --indent 2 .bin/big_array.json)
+    .bin/$bin 0 --sax --file .bin/deep.json | diff - <(cat .bin/deep.json; echo)
+    # validation checks values without building them and reports error offset
+    .bin/$bin 0 --validate --file .bin/big_array.json && .bin/$bin 0 --validate "$escaped" && .bin/$bin 0 --validate "$doc" || echo "Validation failed"
+    echo "$long_escaped" | .bin/$bin 0 --validate || echo "Validation failed"
+    .bin/$bin 0 --validate '{"a": [1, 2] 3}' 2>&1 | diff - <(echo "JSON parse error: Expected ',' between object pairs at offset 13")
+    .bin/$bin 0 --validate '[1, 2] 3' 2>&1 | diff - <(echo "JSON parse error: Unexpected data after value at offset 7")
+    .bin/$bin 0 --validate '["\u12G4"]' 2>&1 | diff - <(echo "JSON parse error: Invalid unicode escape in string at offset 7")
+    # control characters must be escaped in strings, in every mode
+    printf '["a\tb"]' | .bin/$bin 0 --validate 2>&1 | diff - <(echo "JSON parse error: Unescaped control character in string at offset 3")
+    printf '{"a\nb": 1}' | .bin/$bin 0 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unescaped control character in string")
+    printf '["x", "a\x01b"]' | .bin/$bin 0 --raw 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unescaped control character in string")
+    printf '["a\tb"]' | .bin/$bin 0 --push --no-throw --fragment-size 2 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unescaped control character in string at offset 3")
+    # options a mode would ignore are rejected
+    .bin/$bin 0 --sax --query /a '{"a": 1}' 2>&1 | diff - <(echo "--sax does not support --ndjson, --parallel, --keys, --query, --output, --raw, --document, --tape or --stack-formatter, see --help")
+    .bin/$bin 0 --validate --push '[1]' 2>/dev/null && echo "Exclusive modes accepted"
+    .bin/$bin 0 --no-throw --ndjson --file .bin/records.ndjson 2>&1 | diff - <(echo "--no-throw is supported only by plain parsing and --push, without --query or --document, see --help")
+    .bin/$bin 0 --no-throw --query /a '{"a": 1}' 2>&1 | diff - <(echo "--no-throw is supported only by plain parsing and --push, without --query or --document, see --help")
+    # errors recorded instead of thrown end every stream, also in a build without exceptions,
+    # which checks placeholders of missing values under undefined behavior sanitizer
+    g++ -O0 -Wall -Wextra -Wpedantic -Werror -fno-exceptions -fsanitize=undefined -fno-sanitize-recover=all -std=$std "$src" -o ".bin/${bin}_no_exceptions" || echo "Compilation without exceptions failed"
+    for checked in $bin ${bin}_no_exceptions
+    do
+        .bin/$checked 2 --no-throw "$doc" | diff - <(echo "$doc" | jq . --indent 2)
+        .bin/$checked 0 --no-throw '{"a": [1, 2 3], "b": 4}' 2>&1 | diff - <(echo '{"a": [1,2]}'; echo "JSON parse error: Expected ',' between array elements at offset 12")
+        .bin/$checked 0 --no-throw '[1, {"k" 2}]' 2>&1 | diff - <(echo '[1,{}]'; echo "JSON parse error: Expected ':' after key at offset 9")
+        .bin/$checked 0 --no-throw '["\q"]' 2>&1 | diff - <(echo '[]'; echo "JSON parse error: Invalid escape in string: \\q at offset 4")
+        .bin/$checked 0 --no-throw --stack-formatter '{"a": ["b' 2>&1 | diff - <(echo '{"a": [""]}'; echo "JSON parse error: Unterminated string at offset 9")
+        .bin/$checked 0 --no-throw --tape '[1, ["k' 2>&1 | diff - <(echo '[1,[""]]'; echo "JSON parse error: Unterminated string at offset 7")
+        .bin/$checked 0 --validate '[1, 2] 3' 2>&1 | diff - <(echo "JSON parse error: Unexpected data after value at offset 7")
+        # read errors of the input and of the prefetching reader thread are recorded as parsing errors are
+        .bin/$checked 0 --no-throw < .bin 2>&1 | diff - <(echo "JSON parse error: Read error: Is a directory at offset 0")
+        .bin/$checked 0 --no-throw --pipelined < .bin 2>&1 | diff - <(echo "JSON parse error: Read error: Is a directory at offset 0")
+        .bin/$checked 0 --push --no-throw < .bin 2>&1 | diff - <(echo; echo "JSON parse error: Read error: Is a directory at offset 0")
+        # file open errors end the input as read errors, write errors are recorded by the sinks
+        .bin/$checked 0 --no-throw --file .bin/missing.json 2>&1 | diff - <(echo "JSON parse error: Read error: No such file or directory at offset 0")
+        .bin/$checked 0 --no-throw '[1]' 2>&1 >/dev/full | diff - <(echo "JSON parse error: Write error: No space left on device")
+        .bin/$checked 0 --no-throw --pipelined '[1]' 2>&1 >/dev/full | diff - <(echo "JSON parse error: Write error: No space left on device")
+        # push parser counts offsets over all fragments, handler gets no events after the error
+        .bin/$checked 0 --push --no-throw --fragment-size 3 '{"a": [1, 2 3], "b": 4}' 2>&1 | diff - <(echo '{"a": [1,2'; echo "JSON parse error: Expected ',' between array elements at offset 12")
+        .bin/$checked 0 --push --no-throw --fragment-size 1 '[1, "x\q"]' 2>&1 | diff - <(echo '[1'; echo "JSON parse error: Invalid escape in string: \\q at offset 8")
+        .bin/$checked 0 --push --no-throw --fragment-size 2 '[1, ["abc' 2>&1 | diff - <(echo '[1,['; echo "JSON parse error: Unterminated string at offset 9")
+    done
+    # push parser resumes tokens and escapes cut by fragment edges
+    .bin/$bin 2 --push --fragment-size 1 "$escaped" | diff - <(echo "$escaped" | jq . --indent 2)
+    .bin/$bin 2 --push --fragment-size 7 "$doc" | diff - <(echo "$doc" | jq . --indent 2)
+    .bin/$bin 2 --push --fragment-size 3 < .bin/big_array.json | diff - <(jq . --indent 2 .bin/big_array.json)
+    echo "$long_escaped" | .bin/$bin 2 --push | diff - <(echo "$long_escaped" | jq . --indent 2)
+    echo '[1, 2' | .bin/$bin 2 --push --fragment-size 1 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected ',' between array elements")
+    # data after the value is rejected as the lexer does, also in a later fragment
+    .bin/$bin 0 --push --no-throw --fragment-size 2 '[1,2] x' 2>&1 | diff - <(echo '[1,2]'; echo "JSON parse error: Unexpected character: x at offset 6")
+    .bin/$bin 0 --push --no-throw --fragment-size 1 '[1, 2] 3' 2>&1 | diff - <(echo '[1,2]'; echo "JSON parse error: Unexpected data after value at offset 7")
+    .bin/$bin 0 --push '{"a": 1}  ' | diff - <(echo '{"a": 1}')
+    # async streams resume the consumer coroutine as fragments arrive, C++17 has no coroutines
+    if test "$std" != c++17
+    then
+        .bin/$bin 2 --async --fragment-size 1 "$escaped" | diff - <(echo "$escaped" | jq . --indent 2)
+        .bin/$bin 2 --async --fragment-size 7 "$doc" | diff - <(echo "$doc" | jq . --indent 2)
+        .bin/$bin 2 --async < .bin/big_array.json | diff - <(jq . --indent 2 .bin/big_array.json)
+        # errors end the input and are thrown in the waiting consumer instead of leaving it suspended
+        .bin/$bin 0 --async --fragment-size 3 '{"a": [1, 2 3], "b": 4}' 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected ',' between array elements")
+        .bin/$bin 0 --async --fragment-size 1 '{"a": 1, "b"' 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected ':' after key")
+        .bin/$bin 0 --async '[1,2] x' 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unexpected character: x")
+    fi
+    # fuzzing harness binds structs and compares every parsing path on generated documents
+    g++ -g -O1 -Wall -Wextra -Wpedantic -Werror -std=$std -DJSON_FUZZ_MAIN -DJSON_SOURCE="\"../$src\"" fuzz/fuzz.cpp -o ".bin/${bin}_fuzz" \
+        && .bin/${bin}_fuzz --generate 500 || echo "Fuzzing failed"
     # error condition tests
     echo '1.1.2' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Multiple decimal points in number")
+    echo '1.' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected digit after decimal point")
+    echo '-.' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected digit in number")
+    echo '1e' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected digit in exponent")
+    echo '01' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Leading zeros in number")
+    echo '1e400' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Number out of range")
     echo 'foo' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unexpected character: f")
-    echo '"abc' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unterminated string")
+    printf '"abc' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unterminated string")
+    echo '"\q"' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Invalid escape in string: \q")
+    echo '"\u12G4"' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Invalid unicode escape in string")
+    echo '"\ud83d"' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unpaired surrogate in string")
     echo '{"k":}' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected value")
     echo '{"a":1 "b":2}' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected ',' between object pairs")
     echo '{1:2}' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected string key")
     echo '{"a" 1}' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected ':' after key")
     echo '[1 2]' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Expected ',' between array elements")
     echo '{k:1}' | .bin/$bin 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Unexpected character: k")
+    .bin/$bin 2 --query meta '{}' 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Invalid JSON pointer: meta")
+    .bin/$bin 2 --stats '1' 2>&1 1>/dev/null | diff - <(echo "Statistics are not compiled in, rebuild with -DJSON_STATS=1")
+    .bin/$bin 2 --file .bin/missing.json 2>&1 1>/dev/null | diff - <(echo "JSON parse error: Cannot open .bin/missing.json: No such file or directory")
 }
 
 run_tests c++17 json_17.cpp json_17
 run_tests c++23 json_23.cpp json_23
+
+# Throughput regression guard against bench/baseline.ref takes minutes, so it runs on request only
+if test "$1" = --perf
+then
+    ./bench/guard.sh --min-time 0.05 --size 65536 || { echo "Throughput regression guard failed"; exit 1; }
+fi